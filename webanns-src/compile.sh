@@ -1,3 +1,11 @@
+# THREADS=1 ./compile.sh adds pthreads for the parallel index build (setBuildThreads). The page then
+# has to be cross-origin isolated (COOP/COEP headers) to get SharedArrayBuffer, and the worker pool is
+# started up front because insertBatch blocks the calling thread until the build is done.
+THREAD_FLAGS="-s ENVIRONMENT=web"
+if [ "$THREADS" = "1" ]; then
+    THREAD_FLAGS="-pthread -s PTHREAD_POOL_SIZE=navigator.hardwareConcurrency -s ENVIRONMENT=web,worker"
+fi
+
 em++ src/wasm/distance.cpp src/wasm/hnsw.cpp src/wasm/hnsw_main.cpp --bind -O3 \
     -s WASM=1 \
     -msimd128 \
@@ -7,7 +15,7 @@ em++ src/wasm/distance.cpp src/wasm/hnsw.cpp src/wasm/hnsw_main.cpp --bind -O3 \
     -s ASYNCIFY=1 \
     -lembind \
     -s EXPORT_ES6=1 \
-    -s ENVIRONMENT=web \
+    $THREAD_FLAGS \
     -s FILESYSTEM=0 \
     --emit-tsd hnsw_main.d.ts \
     -o ./src/wasm/hnsw_main.js
@@ -0,0 +1,270 @@
+// Headless recall/latency benchmark of the HNSW core, the native counterpart of eval.html.
+//
+//   hnsw_bench [--data arxiv_1k.jsonl] [--graph arxiv_1k_hnsw_graph.jsonl]
+//              [--synthetic N --dim D] [--queries 200] [--warmup 50] [--noise 0.05]
+//              [--ef 10,50,100] [--k 1,10] [--cache FIFO,LRU] [--threshold all,500,100]
+//              [--encoding float32] [--m 16] [--efc 100] [--lazy 0]
+//
+// The data set is either the JSONL dump eval.html imports (its graph file is loaded as it is, or the
+// graph is built when --graph is "") or N clustered random vectors. Queries are data points plus
+// Gaussian noise, the ground truth is brute force. For every cache strategy and items threshold the
+// cache starts empty, --warmup queries are run unmeasured, then one line per ef and k reports
+// recall@k, latency percentiles, full-vector distances per query and the cache hits and misses.
+// Natively every store answers lazy loads at once and those count as hits, so lazy loading is off
+// unless --lazy 1 asks for it.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "hnsw.hpp"
+
+#ifndef WEBANNS_EVAL_DATA
+#define WEBANNS_EVAL_DATA "../webanns-demo/eval_data"
+#endif
+
+struct BenchOptions {
+    std::string data = WEBANNS_EVAL_DATA "/arxiv_1k.jsonl";
+    std::string graph = WEBANNS_EVAL_DATA "/arxiv_1k_hnsw_graph.jsonl";
+    int synthetic = 0;
+    int dim = 128;
+    int queries = 200;
+    int warmup = 50;
+    float noise = 0.05f;
+    std::vector<int> efs = { 10, 50, 100 };
+    std::vector<int> ks = { 1, 10 };
+    std::vector<std::string> caches = { "FIFO", "LRU" };
+    std::vector<std::string> thresholds = { "all" };
+    std::string encoding = "float32";
+    int m = 16;
+    int efConstruction = 100;
+    bool lazy = false;
+};
+
+static std::vector<std::string> splitList(const std::string& list) {
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    if (items.empty()) {
+        throw std::invalid_argument("Empty list: " + list);
+    }
+    return items;
+}
+
+static std::vector<int> splitInts(const std::string& list) {
+    std::vector<int> values;
+    for (const auto& item : splitList(list)) {
+        values.push_back(std::stoi(item));
+    }
+    return values;
+}
+
+static BenchOptions parseOptions(int argc, char** argv) {
+    BenchOptions options;
+    for (int i = 1; i < argc; ++i) {
+        std::string name = argv[i];
+        if (i + 1 >= argc) {
+            throw std::invalid_argument("Missing value for " + name);
+        }
+        std::string value = argv[++i];
+        if (name == "--data") options.data = value;
+        else if (name == "--graph") options.graph = value;
+        else if (name == "--synthetic") options.synthetic = std::stoi(value);
+        else if (name == "--dim") options.dim = std::stoi(value);
+        else if (name == "--queries") options.queries = std::stoi(value);
+        else if (name == "--warmup") options.warmup = std::stoi(value);
+        else if (name == "--noise") options.noise = std::stof(value);
+        else if (name == "--ef") options.efs = splitInts(value);
+        else if (name == "--k") options.ks = splitInts(value);
+        else if (name == "--cache") options.caches = splitList(value);
+        else if (name == "--threshold") options.thresholds = splitList(value);
+        else if (name == "--encoding") options.encoding = value;
+        else if (name == "--m") options.m = std::stoi(value);
+        else if (name == "--efc") options.efConstruction = std::stoi(value);
+        else if (name == "--lazy") options.lazy = std::stoi(value) != 0;
+        else throw std::invalid_argument("Unknown option " + name);
+    }
+    return options;
+}
+
+static std::vector<std::vector<float>> readJsonl(const std::string& path, std::vector<int>& layers) {
+    std::ifstream file(path);
+    if (!file) {
+        throw std::runtime_error("Cannot open " + path);
+    }
+    std::vector<std::vector<float>> vectors;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty()) {
+            continue;
+        }
+        nlohmann::json jsonLine = nlohmann::json::parse(line);
+        vectors.push_back(jsonLine["vector"].get<std::vector<float>>());
+        layers.push_back(jsonLine.contains("layer") ? jsonLine["layer"].get<int>() : -1);
+    }
+    return vectors;
+}
+
+// points around 100 centers, uniform random vectors would give every query the same distances
+static std::vector<std::vector<float>> clusteredVectors(int count, int dim, std::mt19937& rng) {
+    std::normal_distribution<float> centerDist(0.0f, 1.0f);
+    std::normal_distribution<float> pointDist(0.0f, 0.3f);
+    std::vector<std::vector<float>> centers(100, std::vector<float>(dim));
+    for (auto& center : centers) {
+        for (auto& x : center) {
+            x = centerDist(rng);
+        }
+    }
+    std::vector<std::vector<float>> vectors(count, std::vector<float>(dim));
+    for (int i = 0; i < count; ++i) {
+        const auto& center = centers[rng() % centers.size()];
+        for (int d = 0; d < dim; ++d) {
+            vectors[i][d] = center[d] + pointDist(rng);
+        }
+    }
+    return vectors;
+}
+
+static void loadGraph(HNSW& hnsw, const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Cannot open " + path);
+    }
+    std::vector<char> chunk(1 << 16);
+    while (file) {
+        file.read(chunk.data(), chunk.size());
+        hnsw.loadJsonlIndexChunk(chunk.data(), file.gcount(), false);
+    }
+    hnsw.loadJsonlIndexChunk(nullptr, 0, true);
+}
+
+static double percentile(std::vector<double> sorted, double p) {
+    std::sort(sorted.begin(), sorted.end());
+    size_t index = std::min(sorted.size() - 1, (size_t)(p * sorted.size()));
+    return sorted[index];
+}
+
+static void run(const BenchOptions& options) {
+    std::mt19937 rng(7);
+    std::vector<int> layers;
+    std::vector<std::vector<float>> data;
+    if (options.synthetic > 0) {
+        data = clusteredVectors(options.synthetic, options.dim, rng);
+        layers.assign(data.size(), -1);
+    } else {
+        data = readJsonl(options.data, layers);
+    }
+    if (data.empty()) {
+        throw std::runtime_error("No vectors to index");
+    }
+    const int count = data.size();
+    const int dim = data[0].size();
+
+    HNSW hnsw;
+    hnsw.setParams(options.m, options.efConstruction, options.lazy);
+    hnsw.setVectorEncoding(options.encoding);
+    hnsw.nodes.setWasmMemorySize(0); // the cache is sized by items threshold only
+    hnsw.setItemsThreshold(count); // the whole set while building
+
+    auto buildStart = std::chrono::steady_clock::now();
+    if (options.synthetic == 0 && !options.graph.empty()) {
+        loadGraph(hnsw, options.graph);
+        for (int i = 0; i < count; ++i) {
+            hnsw.insertSkipIndex(i, data[i], layers[i]);
+        }
+    } else {
+        std::vector<int> ids(count);
+        std::vector<float> values((size_t)count * dim);
+        for (int i = 0; i < count; ++i) {
+            ids[i] = i;
+            std::copy(data[i].begin(), data[i].end(), values.begin() + (size_t)i * dim);
+        }
+        hnsw.insertBatch(ids.data(), values.data(), count, dim);
+    }
+    double buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - buildStart).count();
+
+    // queries and their exact neighbors, up to the largest k
+    const int maxK = *std::max_element(options.ks.begin(), options.ks.end());
+    std::normal_distribution<float> noise(0.0f, options.noise);
+    std::vector<std::vector<float>> queries(options.queries + options.warmup);
+    for (auto& query : queries) {
+        query = data[rng() % count];
+        for (auto& x : query) {
+            x += noise(rng);
+        }
+    }
+    std::vector<std::vector<int>> truth(options.queries);
+    std::vector<std::pair<float, int>> scored(count);
+    for (int q = 0; q < options.queries; ++q) {
+        for (int i = 0; i < count; ++i) {
+            scored[i] = { DistanceFunctions::euclidean(queries[q], data[i]), i };
+        }
+        int topK = std::min(maxK, count);
+        std::partial_sort(scored.begin(), scored.begin() + topK, scored.end());
+        for (int i = 0; i < topK; ++i) {
+            truth[q].push_back(scored[i].second);
+        }
+    }
+
+    std::printf("# %d vectors of %d dimensions, %s, built or loaded in %.1f ms, %d queries\n",
+        count, dim, options.encoding.c_str(), buildMs, options.queries);
+    std::printf("%-6s %9s %5s %3s %8s %9s %9s %9s %11s %8s %8s\n",
+        "cache", "threshold", "ef", "k", "recall", "p50_ms", "p95_ms", "p99_ms", "dists/query", "hits", "misses");
+
+    for (const auto& cache : options.caches) {
+        for (const auto& threshold : options.thresholds) {
+            for (int ef : options.efs) {
+                for (int k : options.ks) {
+                    hnsw.nodes.setCacheStrategy(cache); // empty again for every configuration
+                    hnsw.setItemsThreshold(threshold == "all" ? count : std::stoi(threshold));
+                    for (int q = 0; q < options.warmup; ++q) {
+                        hnsw.query(queries[options.queries + q], k, ef);
+                    }
+                    hnsw.clearMonitor();
+
+                    std::vector<double> latencies;
+                    double hits = 0;
+                    for (int q = 0; q < options.queries; ++q) {
+                        auto start = std::chrono::steady_clock::now();
+                        hnsw.query(queries[q], k, ef);
+                        latencies.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+                        std::vector<int> expected(truth[q].begin(), truth[q].begin() + std::min(k, (int)truth[q].size()));
+                        for (const auto& result : hnsw.getQueryResults()) {
+                            hits += std::count(expected.begin(), expected.end(), result.iid);
+                        }
+                    }
+
+                    nlohmann::json monitor = nlohmann::json::parse(hnsw.getJsonStrExps());
+                    nlohmann::json counter = monitor["nodes"]["cacheCounter"]["default"];
+                    std::printf("%-6s %9s %5d %3d %8.4f %9.3f %9.3f %9.3f %11.1f %8d %8d\n",
+                        cache.c_str(), threshold.c_str(), ef, k,
+                        hits / ((double)options.queries * std::min(k, count)),
+                        percentile(latencies, 0.50), percentile(latencies, 0.95), percentile(latencies, 0.99),
+                        monitor["distanceCount"].get<double>() / options.queries,
+                        counter["hit"].get<int>(), counter["miss"].get<int>());
+                }
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    try {
+        run(parseOptions(argc, argv));
+    } catch (const std::exception& e) {
+        std::cerr << "hnsw_bench: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
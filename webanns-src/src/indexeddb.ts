@@ -1,9 +1,10 @@
 import Dexie from "dexie";
+import { StoredVector } from "./vectorEncoding";
 
 export class IndexedDBManager {
   kt: Dexie.Table<{ iid: number; key: string }, number>;
-  vt: Dexie.Table<{ iid: number; value: Float32Array }, number>;
-  indexTree: Dexie.Table<{ iid: number; index: string }, number>;
+  vt: Dexie.Table<{ iid: number; value: StoredVector }, number>;
+  indexTree: Dexie.Table<{ iid: number; index: string | string[] }, number>;
 
   constructor() {}
 
@@ -57,16 +58,26 @@ export class IndexedDBManager {
     }
   }
 
-  async setIndexTree(index: string) {
+  async setIndexTree(index: string | string[]) {
     // iid is always 0
     await this.indexTree.put({ iid: 0, index });
   }
 
-  async getIndexTree(): Promise<string> {
+  async getIndexTree(): Promise<string | string[]> {
     const item = await this.indexTree.get(0);
     return item ? item.index : "";
   }
 
+  // the vectorEncoding setting the values table was written with, kept next to the tree
+  async setVectorEncoding(vectorEncoding: string) {
+    await this.indexTree.put({ iid: 1, index: vectorEncoding });
+  }
+
+  async getVectorEncoding(): Promise<string> {
+    const item = await this.indexTree.get(1);
+    return item ? (item.index as string) : "float32";
+  }
+
   async getRandomKey(): Promise<number> {
     try {
       const keys = await this.vt.toCollection().primaryKeys();
@@ -89,18 +100,23 @@ export class IndexedDBManager {
     await this.indexTree.clear();
   }
 
-  async setValue(iid: number, value: Float32Array) {
+  async setValue(iid: number, value: StoredVector) {
     await this.vt.put({ iid, value });
   }
 
-  async getValue(iid: number): Promise<Float32Array> {
+  async bulkSetValues(iids: number[], values: StoredVector[]) {
+    const items = iids.map((iid, index) => ({ iid, value: values[index] }));
+    await this.vt.bulkPut(items);
+  }
+
+  async getValue(iid: number): Promise<StoredVector> {
     const item = await this.vt.get(iid);
     return item ? item.value : new Float32Array(0);
   }
 
   async bulkGetValues(
     iids: number[],
-  ): Promise<{ iid: number; value: Float32Array }[]> {
+  ): Promise<{ iid: number; value: StoredVector }[]> {
     const items = await this.vt.bulkGet(iids);
     return items;
   }
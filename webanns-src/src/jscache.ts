@@ -1,11 +1,13 @@
+import { StoredVector } from "./vectorEncoding";
+
 export interface JSCache {
   maxJsMemory: number;
   embedSize: number;
   itemsThreshold: number;
   strategy: string;
   has(key: number): boolean;
-  get(key: number): Float32Array | undefined;
-  set(key: number, value: Float32Array): void;
+  get(key: number): StoredVector | undefined;
+  set(key: number, value: StoredVector): void;
   delete(key: number): void;
   clear(): void;
   size(): number;
@@ -16,7 +18,7 @@ export interface JSCache {
   getJsMemorySize(): number;
   setJsMemorySize(maxJsMemory: number): void;
   setItemsThreshold(itemsThreshold: number): void;
-  setEmbedSize(embedSize: number): void;
+  setEmbedSize(embedSize: number, bytesPerElement?: number): void;
 
   clearPriorityItems(): void;
   addPriorityItem(keys: number): void;
@@ -24,11 +26,12 @@ export interface JSCache {
 }
 
 export abstract class BaseCache implements JSCache {
-  protected jsCache = new Map<number, Float32Array>();
+  protected jsCache = new Map<number, StoredVector>();
 
   strategy: string;
   maxJsMemory: number;
   embedSize: number;
+  bytesPerElement: number = 4; // 2 when vectors are stored as fp16/bf16
   itemsThreshold: number;
 
   priorityItemList: number[] = [];
@@ -104,7 +107,9 @@ export abstract class BaseCache implements JSCache {
   setJsMemorySize(_maxJsMemory: number) {
     this.maxJsMemory = _maxJsMemory;
     if (this.embedSize > 0) {
-      this.itemsThreshold = Math.floor(this.maxJsMemory / (4 * this.embedSize));
+      this.itemsThreshold = Math.floor(
+        this.maxJsMemory / (this.bytesPerElement * this.embedSize),
+      );
       this.adjustItemsThreshold();
     }
   }
@@ -118,17 +123,20 @@ export abstract class BaseCache implements JSCache {
     this.adjustItemsThreshold();
   }
 
-  setEmbedSize(_embedSize: number) {
+  setEmbedSize(_embedSize: number, _bytesPerElement: number = 4) {
     this.embedSize = _embedSize;
-    this.itemsThreshold = Math.floor(this.maxJsMemory / (4 * this.embedSize));
+    this.bytesPerElement = _bytesPerElement;
+    this.itemsThreshold = Math.floor(
+      this.maxJsMemory / (this.bytesPerElement * this.embedSize),
+    );
     this.adjustItemsThreshold();
   }
 
-  get(key: number): Float32Array | undefined {
+  get(key: number): StoredVector | undefined {
     return this.jsCache.get(key);
   }
 
-  abstract set(key: number, value: Float32Array): void;
+  abstract set(key: number, value: StoredVector): void;
   abstract delete(key: number): void;
   abstract clear(): void;
   abstract deleteSome(): void;
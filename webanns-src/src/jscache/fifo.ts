@@ -1,4 +1,5 @@
 import { BaseCache } from "../jscache";
+import { StoredVector } from "../vectorEncoding";
 
 export class FIFOCache extends BaseCache {
   private fifoList: number[] = [];
@@ -17,9 +18,9 @@ export class FIFOCache extends BaseCache {
     }
   }
 
-  set(key: number, value: Float32Array): void {
+  set(key: number, value: StoredVector): void {
     if (this.embedSize === 0) {
-      this.setEmbedSize(value.length);
+      this.setEmbedSize(value.length, value.BYTES_PER_ELEMENT);
     }
 
     if (this.has(key)) {
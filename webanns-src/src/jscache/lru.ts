@@ -1,4 +1,5 @@
 import { BaseCache } from "../jscache";
+import { StoredVector } from "../vectorEncoding";
 
 class LRUNode {
   key: number;
@@ -65,9 +66,9 @@ export class LRUCache extends BaseCache {
     }
   }
 
-  set(key: number, value: Float32Array): void {
+  set(key: number, value: StoredVector): void {
     if (this.embedSize === 0) {
-      this.setEmbedSize(value.length);
+      this.setEmbedSize(value.length, value.BYTES_PER_ELEMENT);
     }
 
     if (this.jsCache.has(key)) {
@@ -84,7 +85,7 @@ export class LRUCache extends BaseCache {
     }
   }
 
-  get(key: number): Float32Array | undefined {
+  get(key: number): StoredVector | undefined {
     if (this.jsCache.has(key)) {
       const node = this.lruList.get(key)!;
       this.removeNode(node);
@@ -1,4 +1,5 @@
 import { BaseCache } from "../jscache";
+import { StoredVector } from "../vectorEncoding";
 
 export class PriorityFIFOCache extends BaseCache {
   private fifoList: number[] = [];
@@ -46,9 +47,9 @@ export class PriorityFIFOCache extends BaseCache {
     }
   }
 
-  set(key: number, value: Float32Array): void {
+  set(key: number, value: StoredVector): void {
     if (this.embedSize === 0) {
-      this.setEmbedSize(value.length);
+      this.setEmbedSize(value.length, value.BYTES_PER_ELEMENT);
     }
 
     if (this.has(key)) {
@@ -6,6 +6,14 @@ export const expSettings: {
   distanceFunction: "euclidean" | "cosine" | "cosine-normalized";
   cacheStrategy: string;
   lazyLoading: boolean;
+  vectorEncoding: "float32" | "sq8" | "fp16" | "bf16";
+  rerankFactor: number;
+  pqRerankFactor: number;
+  pqSubspaces: number;
+  signPrefilter: boolean;
+  hammingMargin: number;
+  buildThreads: number;
+  queryThreads: number;
   useIndexedDB: boolean;
   prefetchSize: number; // deprecated
   efConstruction: number;
@@ -24,6 +32,14 @@ export const expSettings: {
   distanceFunction: "euclidean",
   cacheStrategy: "FIFO",
   lazyLoading: true,
+  vectorEncoding: "float32", // "sq8": 8-bit rows in wasm, ~4x nodes per wasmMemory; "fp16"/"bf16": 16-bit rows in wasm, JS and IndexedDB
+  rerankFactor: 2, // sq8 only, k * rerankFactor results are reranked with full vectors
+  pqRerankFactor: 4, // the same for pq search; raise it when pqSubspaces is small
+  pqSubspaces: 0, // > 0: build a PQ codebook with this many bytes per vector after loading
+  signPrefilter: false, // build 1-bit sign codes after loading and skip hopeless neighbors on them
+  hammingMargin: 1, // prefilter slack in Hamming standard deviations, larger skips fewer nodes
+  buildThreads: 1, // insertBatch threads, 0 for one per core; needs THREADS=1 ./compile.sh and all vectors in wasm
+  queryThreads: 1, // queryBatch threads, 0 for one per core; same requirements, runs serially otherwise
   useIndexedDB: true,
   prefetchSize: 490000, // deprecated
   efConstruction: 1000,
@@ -5,11 +5,19 @@ import { PriorityFIFOCache } from "./jscache/priorityFifo";
 import { DEBUG } from "./macro";
 import { IndexedDBManager } from "./indexeddb";
 import { CACHECOUNTER, CacheCounters, TIMER, Timers, FastTimer } from "./utils";
+import {
+  FLOAT32,
+  StoredVector,
+  decodeVector,
+  encodeVector,
+  storageEncoding,
+} from "./vectorEncoding";
 
 export class ValueManager {
   useDB = true;
   jsCache: JSCache;
   maxJsMemory: number = 1001 * 768 * 4;
+  encoding: number = FLOAT32; // how vectors are kept in jsCache and IndexedDB
 
   cacheCounters: CacheCounters = new CacheCounters();
   timers: Timers = new Timers();
@@ -57,6 +65,19 @@ export class ValueManager {
     }
   }
 
+  // "fp16"/"bf16" halve the JS and IndexedDB footprint, everything else stores float32
+  setVectorEncoding(vectorEncoding: string) {
+    this.encoding = storageEncoding(vectorEncoding);
+  }
+
+  encode(vector: ArrayLike<number>): StoredVector {
+    return encodeVector(vector, this.encoding);
+  }
+
+  decode(value: StoredVector): Float32Array {
+    return decodeVector(value, this.encoding);
+  }
+
   setJsMemorySize(maxJsMemory: number) {
     this.maxJsMemory = maxJsMemory;
     this.jsCache.setJsMemorySize(maxJsMemory);
@@ -94,8 +115,8 @@ export class ValueManager {
     this.timers.setMode(mode);
   }
 
-  get_nodb(iid: number): Float32Array | undefined {
-    let value: Float32Array | undefined = undefined;
+  get_nodb(iid: number): StoredVector | undefined {
+    let value: StoredVector | undefined = undefined;
 
     if (this.jsCache.has(iid)) {
       if (TIMER) {
@@ -127,8 +148,8 @@ export class ValueManager {
   async get(
     iid: number,
     dbInstance: IndexedDBManager,
-  ): Promise<Float32Array | undefined> {
-    let value: Float32Array | undefined = undefined;
+  ): Promise<StoredVector | undefined> {
+    let value: StoredVector | undefined = undefined;
 
     if (this.jsCache.has(iid)) {
       if (TIMER) {
@@ -165,7 +186,7 @@ export class ValueManager {
     return value;
   }
 
-  set(iid: number, value: Float32Array) {
+  set(iid: number, value: StoredVector) {
     this.jsCache.set(iid, value);
   }
 }
@@ -0,0 +1,133 @@
+// Encodings the JS side stores vectors in. The numbers match VectorEncoding in
+// wasm/vectorcodec.hpp, which passes them to the bridge functions. "sq8" rows only
+// live in wasm, JS keeps float32 vectors for it.
+export const FLOAT32 = 0;
+export const FP16 = 2;
+export const BF16 = 3;
+
+export type StoredVector = Float32Array | Uint16Array;
+
+export function storageEncoding(vectorEncoding: string): number {
+  if (vectorEncoding === "fp16") {
+    return FP16;
+  } else if (vectorEncoding === "bf16") {
+    return BF16;
+  }
+  return FLOAT32;
+}
+
+const floatView = new Float32Array(1);
+const bitsView = new Uint32Array(floatView.buffer);
+
+// round to nearest even, same as floatToBf16 in vectorcodec.hpp
+function floatToBf16(value: number): number {
+  floatView[0] = value;
+  const bits = bitsView[0];
+  if ((bits & 0x7fffffff) > 0x7f800000) {
+    return (bits >>> 16) | 0x40;
+  }
+  return (bits + 0x7fff + ((bits >>> 16) & 1)) >>> 16;
+}
+
+function bf16ToFloat(value: number): number {
+  bitsView[0] = value << 16;
+  return floatView[0];
+}
+
+// round half away from zero, same as floatToHalf in vectorcodec.hpp
+function floatToHalf(value: number): number {
+  floatView[0] = value;
+  const bits = bitsView[0];
+  const sign = (bits >>> 16) & 0x8000;
+  let exponent = ((bits >>> 23) & 0xff) - 127 + 15;
+  let mantissa = bits & 0x7fffff;
+
+  if (((bits >>> 23) & 0xff) === 0xff) {
+    return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+  }
+  if (exponent <= 0) {
+    if (exponent < -10) {
+      return sign;
+    }
+    mantissa = (mantissa | 0x800000) >>> (1 - exponent);
+    return sign | ((mantissa + 0x1000) >>> 13);
+  }
+  mantissa += 0x1000;
+  if (mantissa & 0x800000) {
+    mantissa = 0;
+    exponent += 1;
+  }
+  if (exponent >= 0x1f) {
+    return sign | 0x7c00;
+  }
+  return sign | (exponent << 10) | (mantissa >>> 13);
+}
+
+function halfToFloat(value: number): number {
+  const sign = value & 0x8000 ? -1 : 1;
+  const exponent = (value >>> 10) & 0x1f;
+  const mantissa = value & 0x3ff;
+  if (exponent === 0) {
+    return sign * mantissa * 2 ** -24;
+  } else if (exponent === 0x1f) {
+    return mantissa ? NaN : sign * Infinity;
+  }
+  return sign * (1 + mantissa / 1024) * 2 ** (exponent - 15);
+}
+
+export function encodeVector(
+  vector: ArrayLike<number>,
+  encoding: number,
+): StoredVector {
+  if (encoding === FLOAT32) {
+    return Float32Array.from(vector);
+  }
+  const convert = encoding === FP16 ? floatToHalf : floatToBf16;
+  const encoded = new Uint16Array(vector.length);
+  for (let i = 0; i < vector.length; i++) {
+    encoded[i] = convert(vector[i]);
+  }
+  return encoded;
+}
+
+// encoding tells what a Uint16Array holds, Float32Array values are returned as they are
+export function decodeVector(value: StoredVector, encoding: number): Float32Array {
+  if (value instanceof Float32Array) {
+    return value;
+  }
+  const convert = encoding === FP16 ? halfToFloat : bf16ToFloat;
+  const decoded = new Float32Array(value.length);
+  for (let i = 0; i < value.length; i++) {
+    decoded[i] = convert(value[i]);
+  }
+  return decoded;
+}
+
+// a view of size elements at byte offset ptr of the wasm heap, typed for encoding
+export function heapView(
+  heap: ArrayBuffer,
+  ptr: number,
+  size: number,
+  encoding: number,
+): StoredVector {
+  return encoding === FLOAT32
+    ? new Float32Array(heap, ptr, size)
+    : new Uint16Array(heap, ptr, size);
+}
+
+// copy a stored value (kept in valueEncoding) into wasm memory as targetEncoding,
+// converting only when a database written under another setting is read back
+export function writeVector(
+  heap: ArrayBuffer,
+  ptr: number,
+  value: StoredVector,
+  valueEncoding: number,
+  targetEncoding: number,
+) {
+  const actualEncoding = value instanceof Float32Array ? FLOAT32 : valueEncoding;
+  const converted =
+    actualEncoding === targetEncoding
+      ? value
+      : encodeVector(decodeVector(value, actualEncoding), targetEncoding);
+  heapView(heap, ptr, value.length, targetEncoding).set(converted);
+}
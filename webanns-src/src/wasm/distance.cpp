@@ -1,18 +1,40 @@
 #include "hnsw.hpp"
 
-float DistanceFunctions::calculate(const std::vector<float>& a, const std::vector<float>& b){
-    if (a.size() != b.size()) {
-        throw std::invalid_argument("Vectors must be of the same length");
-    }
-    if (nameFunction == "euclidean") {
-        return round(euclidean(a, b), distancePrecision);
-    } else if (nameFunction == "cosine") {
-        return round(cosine(a, b), distancePrecision);
-    } else if (nameFunction == "cosine-normalized") {
-        return round(cosineNormalized(a, b), distancePrecision);
+#ifdef __wasm_simd128__
+#include <wasm_simd128.h>
+#endif
+
+void DistanceFunctions::setFunction(const std::string& name) {
+    if (name == "euclidean") {
+        metric = EUCLIDEAN;
+    } else if (name == "cosine") {
+        metric = COSINE;
+    } else if (name == "cosine-normalized") {
+        metric = COSINE_NORMALIZED;
     } else {
         throw std::invalid_argument("Unknown distance function");
     }
+    nameFunction = name;
+    selectKernel();
+}
+
+void DistanceFunctions::setDimension(int _dimension) {
+    if (_dimension != dimension) {
+        dimension = _dimension;
+        selectKernel();
+    }
+}
+
+void DistanceFunctions::setPrecision(int _distancePrecision) {
+    distancePrecision = _distancePrecision;
+    roundScale = std::pow(10.0, distancePrecision);
+}
+
+float DistanceFunctions::calculate(const std::vector<float>& a, const std::vector<float>& b) const {
+    if (a.size() != b.size() || (dimension > 0 && a.size() != dimension)) {
+        throw std::invalid_argument("Vectors must be of the same length");
+    }
+    return calculate(a.data(), b.data(), a.size());
 }
 
 float DistanceFunctions::round(float num, int decimal) const {
@@ -21,27 +43,482 @@ float DistanceFunctions::round(float num, int decimal) const {
 
 // Euclidean distance function
 float DistanceFunctions::euclidean(const std::vector<float>& a, const std::vector<float>& b) {
-    return std::sqrt(std::inner_product(a.begin(), a.end(), b.begin(), 0.0, std::plus<>(), [](float aa, float bb) {
-        return (aa - bb) * (aa - bb);
-    }));
+    return euclidean(a.data(), b.data(), a.size());
 }
 
 // Cosine distance function
 float DistanceFunctions::cosine(const std::vector<float>& a, const std::vector<float>& b) {
-    float dotProduct = std::inner_product(a.begin(), a.end(), b.begin(), 0.0);
-    float magnitudeA = std::sqrt(std::accumulate(a.begin(), a.end(), 0.0, [](float sum, float val) {
-        return sum + val * val;
-    }));
-    float magnitudeB = std::sqrt(std::accumulate(b.begin(), b.end(), 0.0, [](float sum, float val) {
-        return sum + val * val;
-    }));
-    return 1.0 - (dotProduct / (magnitudeA * magnitudeB));
+    return cosine(a.data(), b.data(), a.size());
 }
 
 // Cosine-normalized distance function
 float DistanceFunctions::cosineNormalized(const std::vector<float>& a, const std::vector<float>& b) {
-    float dotProduct = std::inner_product(a.begin(), a.end(), b.begin(), 0.0);
-    return 1.0 - dotProduct;
+    return cosineNormalized(a.data(), b.data(), a.size());
+}
+
+// one FP16/BF16 element to float, for the scalar paths and the SIMD tails
+template <VectorEncoding Encoding>
+static inline float decodeHalf(uint16_t value) {
+    return Encoding == VectorEncoding::BF16 ? bf16ToFloat(value) : halfToFloat(value);
+}
+
+#ifdef __wasm_simd128__
+
+// Horizontal sum of the four lanes of a f32x4
+static inline float hsum(v128_t v) {
+    return wasm_f32x4_extract_lane(v, 0) + wasm_f32x4_extract_lane(v, 1)
+         + wasm_f32x4_extract_lane(v, 2) + wasm_f32x4_extract_lane(v, 3);
+}
+
+// The kernels below are templated on the dimension (0 = runtime size). They keep
+// four independent f32x4 accumulators (16 floats per step) so the adds do not
+// serialize on a single register, then finish with a scalar tail.
+template <int Dim>
+static inline float squaredL2Kernel(const float* a, const float* b, int runtimeSize) {
+    const int size = Dim > 0 ? Dim : runtimeSize;
+    v128_t acc0 = wasm_f32x4_splat(0.0f);
+    v128_t acc1 = wasm_f32x4_splat(0.0f);
+    v128_t acc2 = wasm_f32x4_splat(0.0f);
+    v128_t acc3 = wasm_f32x4_splat(0.0f);
+
+    int i = 0;
+    for (; i + 16 <= size; i += 16) {
+        v128_t d0 = wasm_f32x4_sub(wasm_v128_load(a + i), wasm_v128_load(b + i));
+        v128_t d1 = wasm_f32x4_sub(wasm_v128_load(a + i + 4), wasm_v128_load(b + i + 4));
+        v128_t d2 = wasm_f32x4_sub(wasm_v128_load(a + i + 8), wasm_v128_load(b + i + 8));
+        v128_t d3 = wasm_f32x4_sub(wasm_v128_load(a + i + 12), wasm_v128_load(b + i + 12));
+        acc0 = wasm_f32x4_add(acc0, wasm_f32x4_mul(d0, d0));
+        acc1 = wasm_f32x4_add(acc1, wasm_f32x4_mul(d1, d1));
+        acc2 = wasm_f32x4_add(acc2, wasm_f32x4_mul(d2, d2));
+        acc3 = wasm_f32x4_add(acc3, wasm_f32x4_mul(d3, d3));
+    }
+    for (; i + 4 <= size; i += 4) {
+        v128_t d = wasm_f32x4_sub(wasm_v128_load(a + i), wasm_v128_load(b + i));
+        acc0 = wasm_f32x4_add(acc0, wasm_f32x4_mul(d, d));
+    }
+
+    float sum = hsum(wasm_f32x4_add(wasm_f32x4_add(acc0, acc1), wasm_f32x4_add(acc2, acc3)));
+    for (; i < size; ++i) {
+        float d = a[i] - b[i];
+        sum += d * d;
+    }
+    return sum;
+}
+
+template <int Dim>
+static inline float dotKernel(const float* a, const float* b, int runtimeSize) {
+    const int size = Dim > 0 ? Dim : runtimeSize;
+    v128_t acc0 = wasm_f32x4_splat(0.0f);
+    v128_t acc1 = wasm_f32x4_splat(0.0f);
+    v128_t acc2 = wasm_f32x4_splat(0.0f);
+    v128_t acc3 = wasm_f32x4_splat(0.0f);
+
+    int i = 0;
+    for (; i + 16 <= size; i += 16) {
+        acc0 = wasm_f32x4_add(acc0, wasm_f32x4_mul(wasm_v128_load(a + i), wasm_v128_load(b + i)));
+        acc1 = wasm_f32x4_add(acc1, wasm_f32x4_mul(wasm_v128_load(a + i + 4), wasm_v128_load(b + i + 4)));
+        acc2 = wasm_f32x4_add(acc2, wasm_f32x4_mul(wasm_v128_load(a + i + 8), wasm_v128_load(b + i + 8)));
+        acc3 = wasm_f32x4_add(acc3, wasm_f32x4_mul(wasm_v128_load(a + i + 12), wasm_v128_load(b + i + 12)));
+    }
+    for (; i + 4 <= size; i += 4) {
+        acc0 = wasm_f32x4_add(acc0, wasm_f32x4_mul(wasm_v128_load(a + i), wasm_v128_load(b + i)));
+    }
+
+    float sum = hsum(wasm_f32x4_add(wasm_f32x4_add(acc0, acc1), wasm_f32x4_add(acc2, acc3)));
+    for (; i < size; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+template <int Dim>
+static inline void dotAndNormsKernel(const float* a, const float* b, int runtimeSize, float& dotProduct, float& normA, float& normB) {
+    const int size = Dim > 0 ? Dim : runtimeSize;
+    v128_t accDot0 = wasm_f32x4_splat(0.0f), accDot1 = wasm_f32x4_splat(0.0f);
+    v128_t accA0 = wasm_f32x4_splat(0.0f), accA1 = wasm_f32x4_splat(0.0f);
+    v128_t accB0 = wasm_f32x4_splat(0.0f), accB1 = wasm_f32x4_splat(0.0f);
+
+    int i = 0;
+    for (; i + 8 <= size; i += 8) {
+        v128_t va0 = wasm_v128_load(a + i), vb0 = wasm_v128_load(b + i);
+        v128_t va1 = wasm_v128_load(a + i + 4), vb1 = wasm_v128_load(b + i + 4);
+        accDot0 = wasm_f32x4_add(accDot0, wasm_f32x4_mul(va0, vb0));
+        accDot1 = wasm_f32x4_add(accDot1, wasm_f32x4_mul(va1, vb1));
+        accA0 = wasm_f32x4_add(accA0, wasm_f32x4_mul(va0, va0));
+        accA1 = wasm_f32x4_add(accA1, wasm_f32x4_mul(va1, va1));
+        accB0 = wasm_f32x4_add(accB0, wasm_f32x4_mul(vb0, vb0));
+        accB1 = wasm_f32x4_add(accB1, wasm_f32x4_mul(vb1, vb1));
+    }
+
+    dotProduct = hsum(wasm_f32x4_add(accDot0, accDot1));
+    normA = hsum(wasm_f32x4_add(accA0, accA1));
+    normB = hsum(wasm_f32x4_add(accB0, accB1));
+    for (; i < size; ++i) {
+        dotProduct += a[i] * b[i];
+        normA += a[i] * a[i];
+        normB += b[i] * b[i];
+    }
+}
+
+// Asymmetric float query x SQ8 codes: widens 16 codes per step to f32x4 and returns the three
+// sums the SQ8 distances are rebuilt from (q . codes, sum(q), |q|^2) in a single pass.
+template <int Dim>
+static inline void sq8SumsKernel(const float* q, const uint8_t* codes, int runtimeSize, float& dotCodes, float& sumQ, float& normQ) {
+    const int size = Dim > 0 ? Dim : runtimeSize;
+    v128_t accDot0 = wasm_f32x4_splat(0.0f), accDot1 = wasm_f32x4_splat(0.0f);
+    v128_t accSum = wasm_f32x4_splat(0.0f), accNorm = wasm_f32x4_splat(0.0f);
+
+    int i = 0;
+    for (; i + 16 <= size; i += 16) {
+        v128_t c8 = wasm_v128_load(codes + i);
+        v128_t c16lo = wasm_u16x8_extend_low_u8x16(c8);
+        v128_t c16hi = wasm_u16x8_extend_high_u8x16(c8);
+        v128_t c0 = wasm_f32x4_convert_u32x4(wasm_u32x4_extend_low_u16x8(c16lo));
+        v128_t c1 = wasm_f32x4_convert_u32x4(wasm_u32x4_extend_high_u16x8(c16lo));
+        v128_t c2 = wasm_f32x4_convert_u32x4(wasm_u32x4_extend_low_u16x8(c16hi));
+        v128_t c3 = wasm_f32x4_convert_u32x4(wasm_u32x4_extend_high_u16x8(c16hi));
+        v128_t q0 = wasm_v128_load(q + i), q1 = wasm_v128_load(q + i + 4);
+        v128_t q2 = wasm_v128_load(q + i + 8), q3 = wasm_v128_load(q + i + 12);
+        accDot0 = wasm_f32x4_add(accDot0, wasm_f32x4_add(wasm_f32x4_mul(q0, c0), wasm_f32x4_mul(q1, c1)));
+        accDot1 = wasm_f32x4_add(accDot1, wasm_f32x4_add(wasm_f32x4_mul(q2, c2), wasm_f32x4_mul(q3, c3)));
+        accSum = wasm_f32x4_add(accSum, wasm_f32x4_add(wasm_f32x4_add(q0, q1), wasm_f32x4_add(q2, q3)));
+        accNorm = wasm_f32x4_add(accNorm, wasm_f32x4_add(
+            wasm_f32x4_add(wasm_f32x4_mul(q0, q0), wasm_f32x4_mul(q1, q1)),
+            wasm_f32x4_add(wasm_f32x4_mul(q2, q2), wasm_f32x4_mul(q3, q3))));
+    }
+
+    dotCodes = hsum(wasm_f32x4_add(accDot0, accDot1));
+    sumQ = hsum(accSum);
+    normQ = hsum(accNorm);
+    for (; i < size; ++i) {
+        dotCodes += q[i] * codes[i];
+        sumQ += q[i];
+        normQ += q[i] * q[i];
+    }
+}
+
+// Four FP16 values widened to u32 lanes -> f32x4, the same bit trick as halfToFloat(), inf and NaN
+// lanes included.
+static inline v128_t halfLanesToFloat(v128_t lanes) {
+    v128_t bits = wasm_i32x4_shl(wasm_v128_and(lanes, wasm_i32x4_splat(0x7fff)), 13);
+    v128_t magnitude = wasm_f32x4_mul(bits, wasm_f32x4_splat(0x1p112f));
+    v128_t special = wasm_i32x4_eq(wasm_v128_and(lanes, wasm_i32x4_splat(0x7c00)), wasm_i32x4_splat(0x7c00));
+    magnitude = wasm_v128_bitselect(wasm_v128_or(bits, wasm_i32x4_splat(0x7f800000)), magnitude, special);
+    return wasm_v128_or(magnitude, wasm_i32x4_shl(wasm_v128_and(lanes, wasm_i32x4_splat(0x8000)), 16));
+}
+
+// Eight half-precision values -> two f32x4. BF16 is the upper half of a float32, so widening
+// and shifting is the whole conversion.
+template <VectorEncoding Encoding>
+static inline void loadHalf8(const uint16_t* x, v128_t& lo, v128_t& hi) {
+    v128_t h = wasm_v128_load(x);
+    lo = wasm_u32x4_extend_low_u16x8(h);
+    hi = wasm_u32x4_extend_high_u16x8(h);
+    if (Encoding == VectorEncoding::BF16) {
+        lo = wasm_i32x4_shl(lo, 16);
+        hi = wasm_i32x4_shl(hi, 16);
+    } else {
+        lo = halfLanesToFloat(lo);
+        hi = halfLanesToFloat(hi);
+    }
+}
+
+// Float query x half-precision row, converted in registers 8 values per step. sum is the squared
+// L2 distance for EUCLIDEAN and the dot product otherwise; the norms are only summed for COSINE.
+template <VectorEncoding Encoding, int Metric, int Dim>
+static inline void halfSumsKernel(const float* q, const uint16_t* x, int runtimeSize, float& sum, float& normQ, float& normX) {
+    const int size = Dim > 0 ? Dim : runtimeSize;
+    v128_t acc0 = wasm_f32x4_splat(0.0f), acc1 = wasm_f32x4_splat(0.0f);
+    v128_t accQ = wasm_f32x4_splat(0.0f), accX = wasm_f32x4_splat(0.0f);
+
+    int i = 0;
+    for (; i + 8 <= size; i += 8) {
+        v128_t x0, x1;
+        loadHalf8<Encoding>(x + i, x0, x1);
+        v128_t q0 = wasm_v128_load(q + i), q1 = wasm_v128_load(q + i + 4);
+        if (Metric == EUCLIDEAN) {
+            v128_t d0 = wasm_f32x4_sub(q0, x0), d1 = wasm_f32x4_sub(q1, x1);
+            acc0 = wasm_f32x4_add(acc0, wasm_f32x4_mul(d0, d0));
+            acc1 = wasm_f32x4_add(acc1, wasm_f32x4_mul(d1, d1));
+        } else {
+            acc0 = wasm_f32x4_add(acc0, wasm_f32x4_mul(q0, x0));
+            acc1 = wasm_f32x4_add(acc1, wasm_f32x4_mul(q1, x1));
+        }
+        if (Metric == COSINE) {
+            accQ = wasm_f32x4_add(accQ, wasm_f32x4_add(wasm_f32x4_mul(q0, q0), wasm_f32x4_mul(q1, q1)));
+            accX = wasm_f32x4_add(accX, wasm_f32x4_add(wasm_f32x4_mul(x0, x0), wasm_f32x4_mul(x1, x1)));
+        }
+    }
+
+    sum = hsum(wasm_f32x4_add(acc0, acc1));
+    normQ = hsum(accQ);
+    normX = hsum(accX);
+    for (; i < size; ++i) {
+        float xi = decodeHalf<Encoding>(x[i]);
+        sum += Metric == EUCLIDEAN ? (q[i] - xi) * (q[i] - xi) : q[i] * xi;
+        normQ += q[i] * q[i];
+        normX += xi * xi;
+    }
+}
+
+#else
+
+// Scalar fallback for native builds. Four independent accumulators break the
+// loop-carried dependency so the compiler can keep several adds in flight;
+// a fixed Dim lets it unroll and vectorize the whole loop.
+template <int Dim>
+static inline float squaredL2Kernel(const float* a, const float* b, int runtimeSize) {
+    const int size = Dim > 0 ? Dim : runtimeSize;
+    float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+    int i = 0;
+    for (; i + 4 <= size; i += 4) {
+        float d0 = a[i] - b[i];
+        float d1 = a[i + 1] - b[i + 1];
+        float d2 = a[i + 2] - b[i + 2];
+        float d3 = a[i + 3] - b[i + 3];
+        s0 += d0 * d0;
+        s1 += d1 * d1;
+        s2 += d2 * d2;
+        s3 += d3 * d3;
+    }
+    for (; i < size; ++i) {
+        float d = a[i] - b[i];
+        s0 += d * d;
+    }
+    return (s0 + s1) + (s2 + s3);
 }
 
+template <int Dim>
+static inline float dotKernel(const float* a, const float* b, int runtimeSize) {
+    const int size = Dim > 0 ? Dim : runtimeSize;
+    float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+    int i = 0;
+    for (; i + 4 <= size; i += 4) {
+        s0 += a[i] * b[i];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
+    }
+    for (; i < size; ++i) {
+        s0 += a[i] * b[i];
+    }
+    return (s0 + s1) + (s2 + s3);
+}
 
+template <int Dim>
+static inline void dotAndNormsKernel(const float* a, const float* b, int runtimeSize, float& dotProduct, float& normA, float& normB) {
+    const int size = Dim > 0 ? Dim : runtimeSize;
+    float d0 = 0.0f, d1 = 0.0f, a0 = 0.0f, a1 = 0.0f, b0 = 0.0f, b1 = 0.0f;
+    int i = 0;
+    for (; i + 2 <= size; i += 2) {
+        d0 += a[i] * b[i];
+        d1 += a[i + 1] * b[i + 1];
+        a0 += a[i] * a[i];
+        a1 += a[i + 1] * a[i + 1];
+        b0 += b[i] * b[i];
+        b1 += b[i + 1] * b[i + 1];
+    }
+    for (; i < size; ++i) {
+        d0 += a[i] * b[i];
+        a0 += a[i] * a[i];
+        b0 += b[i] * b[i];
+    }
+    dotProduct = d0 + d1;
+    normA = a0 + a1;
+    normB = b0 + b1;
+}
+
+template <int Dim>
+static inline void sq8SumsKernel(const float* q, const uint8_t* codes, int runtimeSize, float& dotCodes, float& sumQ, float& normQ) {
+    const int size = Dim > 0 ? Dim : runtimeSize;
+    float d0 = 0.0f, d1 = 0.0f, s0 = 0.0f, s1 = 0.0f, n0 = 0.0f, n1 = 0.0f;
+    int i = 0;
+    for (; i + 2 <= size; i += 2) {
+        d0 += q[i] * codes[i];
+        d1 += q[i + 1] * codes[i + 1];
+        s0 += q[i];
+        s1 += q[i + 1];
+        n0 += q[i] * q[i];
+        n1 += q[i + 1] * q[i + 1];
+    }
+    for (; i < size; ++i) {
+        d0 += q[i] * codes[i];
+        s0 += q[i];
+        n0 += q[i] * q[i];
+    }
+    dotCodes = d0 + d1;
+    sumQ = s0 + s1;
+    normQ = n0 + n1;
+}
+
+template <VectorEncoding Encoding, int Metric, int Dim>
+static inline void halfSumsKernel(const float* q, const uint16_t* x, int runtimeSize, float& sum, float& normQ, float& normX) {
+    const int size = Dim > 0 ? Dim : runtimeSize;
+    float s0 = 0.0f, s1 = 0.0f, nq = 0.0f, nx = 0.0f;
+    int i = 0;
+    for (; i + 2 <= size; i += 2) {
+        float x0 = decodeHalf<Encoding>(x[i]);
+        float x1 = decodeHalf<Encoding>(x[i + 1]);
+        if (Metric == EUCLIDEAN) {
+            s0 += (q[i] - x0) * (q[i] - x0);
+            s1 += (q[i + 1] - x1) * (q[i + 1] - x1);
+        } else {
+            s0 += q[i] * x0;
+            s1 += q[i + 1] * x1;
+        }
+        if (Metric == COSINE) {
+            nq += q[i] * q[i] + q[i + 1] * q[i + 1];
+            nx += x0 * x0 + x1 * x1;
+        }
+    }
+    for (; i < size; ++i) {
+        float xi = decodeHalf<Encoding>(x[i]);
+        s0 += Metric == EUCLIDEAN ? (q[i] - xi) * (q[i] - xi) : q[i] * xi;
+        nq += q[i] * q[i];
+        nx += xi * xi;
+    }
+    sum = s0 + s1;
+    normQ = nq;
+    normX = nx;
+}
+
+#endif
+
+template <int Metric, int Dim>
+static float metricKernel(const float* a, const float* b, int size) {
+    if (Metric == EUCLIDEAN) {
+        return std::sqrt(squaredL2Kernel<Dim>(a, b, size));
+    } else if (Metric == COSINE) {
+        float dotProduct, normA, normB;
+        dotAndNormsKernel<Dim>(a, b, size, dotProduct, normA, normB);
+        return 1.0f - (dotProduct / (std::sqrt(normA) * std::sqrt(normB)));
+    } else {
+        return 1.0f - dotKernel<Dim>(a, b, size);
+    }
+}
+
+// Distance between a float query and an SQ8 row (see vectorcodec.hpp), rebuilt from the
+// decoded vector x = lo + step * codes: q.x = lo * sum(q) + step * (q . codes).
+template <int Metric, int Dim>
+static float sq8MetricKernel(const float* q, const uint8_t* row, int size) {
+    const SQ8Header* header = reinterpret_cast<const SQ8Header*>(row);
+    float dotCodes, sumQ, normQ;
+    sq8SumsKernel<Dim>(q, row + sizeof(SQ8Header), size, dotCodes, sumQ, normQ);
+    float dotProduct = header->lo * sumQ + header->step * dotCodes;
+    if (Metric == EUCLIDEAN) {
+        return std::sqrt(std::max(0.0f, normQ - 2.0f * dotProduct + header->normSq));
+    } else if (Metric == COSINE) {
+        return 1.0f - (dotProduct / (std::sqrt(normQ) * std::sqrt(header->normSq)));
+    } else {
+        return 1.0f - dotProduct;
+    }
+}
+
+// Distance between a float query and an FP16/BF16 row, converted on the fly.
+template <VectorEncoding Encoding, int Metric, int Dim>
+static float halfMetricKernel(const float* q, const uint8_t* row, int size) {
+    float sum, normQ, normX;
+    halfSumsKernel<Encoding, Metric, Dim>(q, reinterpret_cast<const uint16_t*>(row), size, sum, normQ, normX);
+    if (Metric == EUCLIDEAN) {
+        return std::sqrt(sum);
+    } else if (Metric == COSINE) {
+        return 1.0f - (sum / (std::sqrt(normQ) * std::sqrt(normX)));
+    } else {
+        return 1.0f - sum;
+    }
+}
+
+// Row kernels for every encoding share one signature so the cache encoding picks a table entry.
+template <int Metric, int Dim>
+static float floatRowKernel(const float* q, const uint8_t* row, int size) {
+    return metricKernel<Metric, Dim>(q, reinterpret_cast<const float*>(row), size);
+}
+
+template <int Metric, int Dim>
+static float fp16MetricKernel(const float* q, const uint8_t* row, int size) {
+    return halfMetricKernel<VectorEncoding::FP16, Metric, Dim>(q, row, size);
+}
+
+template <int Metric, int Dim>
+static float bf16MetricKernel(const float* q, const uint8_t* row, int size) {
+    return halfMetricKernel<VectorEncoding::BF16, Metric, Dim>(q, row, size);
+}
+
+// Embedding sizes produced by the models we ship with; other sizes use the runtime-length kernel.
+#define SPECIALIZED_KERNELS(KERNEL, METRIC) \
+    { 0, &KERNEL<METRIC, 0> }, \
+    { 384, &KERNEL<METRIC, 384> }, \
+    { 768, &KERNEL<METRIC, 768> }, \
+    { 1024, &KERNEL<METRIC, 1024> }, \
+    { 1536, &KERNEL<METRIC, 1536> }
+
+static const std::pair<int, DistanceFunctions::Kernel> kernelTable[][5] = {
+    { SPECIALIZED_KERNELS(metricKernel, EUCLIDEAN) },
+    { SPECIALIZED_KERNELS(metricKernel, COSINE) },
+    { SPECIALIZED_KERNELS(metricKernel, COSINE_NORMALIZED) },
+};
+
+// [encoding][metric], in VectorEncoding order
+static const std::pair<int, DistanceFunctions::RowKernel> rowKernelTable[NUM_VECTOR_ENCODINGS][3][5] = {
+    {
+        { SPECIALIZED_KERNELS(floatRowKernel, EUCLIDEAN) },
+        { SPECIALIZED_KERNELS(floatRowKernel, COSINE) },
+        { SPECIALIZED_KERNELS(floatRowKernel, COSINE_NORMALIZED) },
+    },
+    {
+        { SPECIALIZED_KERNELS(sq8MetricKernel, EUCLIDEAN) },
+        { SPECIALIZED_KERNELS(sq8MetricKernel, COSINE) },
+        { SPECIALIZED_KERNELS(sq8MetricKernel, COSINE_NORMALIZED) },
+    },
+    {
+        { SPECIALIZED_KERNELS(fp16MetricKernel, EUCLIDEAN) },
+        { SPECIALIZED_KERNELS(fp16MetricKernel, COSINE) },
+        { SPECIALIZED_KERNELS(fp16MetricKernel, COSINE_NORMALIZED) },
+    },
+    {
+        { SPECIALIZED_KERNELS(bf16MetricKernel, EUCLIDEAN) },
+        { SPECIALIZED_KERNELS(bf16MetricKernel, COSINE) },
+        { SPECIALIZED_KERNELS(bf16MetricKernel, COSINE_NORMALIZED) },
+    },
+};
+
+template <typename KernelType>
+static KernelType lookupKernel(const std::pair<int, KernelType> (&candidates)[5], int dimension) {
+    for (const auto& [dim, specialized] : candidates) {
+        if (dim == dimension) {
+            return specialized;
+        }
+    }
+    return candidates[0].second;
+}
+
+void DistanceFunctions::selectKernel() {
+    kernel = lookupKernel(kernelTable[metric], dimension);
+    for (int encoding = 0; encoding < NUM_VECTOR_ENCODINGS; ++encoding) {
+        rowKernels[encoding] = lookupKernel(rowKernelTable[encoding][metric], dimension);
+    }
+}
+
+float DistanceFunctions::euclidean(const float* a, const float* b, int size) {
+    return metricKernel<EUCLIDEAN, 0>(a, b, size);
+}
+
+float DistanceFunctions::cosine(const float* a, const float* b, int size) {
+    return metricKernel<COSINE, 0>(a, b, size);
+}
+
+float DistanceFunctions::cosineNormalized(const float* a, const float* b, int size) {
+    return metricKernel<COSINE_NORMALIZED, 0>(a, b, size);
+}
+
+float DistanceFunctions::squaredL2(const float* a, const float* b, int size) {
+    return squaredL2Kernel<0>(a, b, size);
+}
+
+float DistanceFunctions::dot(const float* a, const float* b, int size) {
+    return dotKernel<0>(a, b, size);
+}
+
+void DistanceFunctions::dotAndNorms(const float* a, const float* b, int size, float& dotProduct, float& normA, float& normB) {
+    dotAndNormsKernel<0>(a, b, size, dotProduct, normA, normB);
+}
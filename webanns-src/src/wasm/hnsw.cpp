@@ -1,11 +1,57 @@
 #include "hnsw.hpp"
 
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <exception>
+
 std::vector<Candidate> HNSW::getQueryResults() {
     return globalQueryResults;
 }
 
+void GraphLayer::freeze() {
+    if (overlayRows == 0) {
+        return;
+    }
+
+    std::vector<int> newOffsets(rowIids.size() + 1, 0);
+    std::vector<int> newNeighborIds;
+    for (int row = 0; row < (int)rowIids.size(); ++row) {
+        if (row < (int)inOverlay.size() && inOverlay[row]) {
+            newNeighborIds.insert(newNeighborIds.end(), overlay[row].begin(), overlay[row].end());
+        } else {
+            newNeighborIds.insert(newNeighborIds.end(), neighborIds.begin() + offsets[row], neighborIds.begin() + offsets[row + 1]);
+        }
+        newOffsets[row + 1] = newNeighborIds.size();
+    }
+
+    offsets.swap(newOffsets);
+    neighborIds.swap(newNeighborIds);
+    frozenRows = rowIids.size();
+
+    std::vector<std::vector<int>>().swap(overlay);
+    std::vector<bool>().swap(inOverlay);
+    overlayRows = 0;
+}
+
+void HNSW::freezeGraph() {
+    for (auto& graphLayer : graphLayers) {
+        graphLayer.freeze();
+    }
+}
+
+void HNSW::freezeGrownLayers() {
+    for (auto& graphLayer : graphLayers) {
+        if (graphLayer.overlayRows * 4 >= graphLayer.size()) {
+            graphLayer.freeze();
+        }
+    }
+}
+
 void HNSW::clearMonitor() {
     timers.clear();
+    signSkips = 0;
+    distanceCount = 0;
     nodes.clearMonitor();
 }
 
@@ -22,11 +68,18 @@ std::string HNSW::getJsonStrExps() {
     jsonIndex["ml"] = ml;
     jsonIndex["seed"] = seed;
     jsonIndex["distanceFunctionType"] = distanceFunction.nameFunction;
-    jsonIndex["entryPointKey"] = epId;
+    jsonIndex["entryPointKey"] = epId == -1 ? -1 : ids.external(epId);
     jsonIndex["len(nodes)"] = nodes.size();
     jsonIndex["len(graphLayers)"] = graphLayers.size();
     jsonIndex["timer"] = timers.toJson();
     jsonIndex["nodes"] = nodes.toJson();
+    if (DISTANCECOUNTER) {
+        jsonIndex["distanceCount"] = distanceCount;
+    }
+    if (signCodes.trained()) {
+        jsonIndex["signCodesBytes"] = signCodes.allocatedBytes();
+        jsonIndex["signPrefilterSkips"] = signSkips;
+    }
 
     return jsonIndex.dump();
 }
@@ -59,14 +112,82 @@ void HNSW::print() const {
 }
 
 float HNSW::calDistance(const std::vector<float>& a, const std::vector<float>& b) {
+    if (DISTANCECOUNTER){
+        ++distanceCount;
+    }
     float distance = distanceFunction.calculate(a, b);
     return distance;
 }
 
-std::string HNSW::exportJsonlIndex() {
+float HNSW::calDistance(const float* a, const VectorView& b) {
+    if (DISTANCECOUNTER){
+        ++distanceCount;
+    }
+    return distanceFunction.calculate(a, b);
+}
+
+// floats of view, decoded into scratch when the cache holds encoded rows
+static const float* floatsOf(const VectorView& view, std::vector<float>& scratch) {
+    if (view.encoding == VectorEncoding::FLOAT32) {
+        return view.floats();
+    }
+    scratch.resize(view.size);
+    decodeRow(view.encoding, view.data, view.size, scratch.data());
+    return scratch.data();
+}
+
+// Appends JSONL lines into a reused buffer and hands it to sink whenever it reaches chunkSize,
+// so the export never holds more than about one chunk of text.
+class JsonlChunkWriter {
+public:
+    JsonlChunkWriter(const std::function<void(const char*, size_t)>& _sink, size_t _chunkSize)
+        : sink(_sink), chunkSize(_chunkSize) {
+        buffer.reserve(chunkSize + 64);
+    }
+
+    void line(const std::string& text) {
+        buffer += text;
+        buffer += '\n';
+        flushIfFull();
+    }
+
+    // {"<name>":<value>}
+    void idLine(const char* prefix, size_t prefixLength, int value) {
+        char digits[16];
+        char* digitsEnd = std::to_chars(digits, digits + sizeof(digits), value).ptr;
+        buffer.append(prefix, prefixLength);
+        buffer.append(digits, digitsEnd - digits);
+        buffer += "}\n";
+        flushIfFull();
+    }
+
+    void flush() {
+        if (!buffer.empty()) {
+            sink(buffer.data(), buffer.size());
+            buffer.clear();
+        }
+    }
+
+private:
+    const std::function<void(const char*, size_t)>& sink;
+    size_t chunkSize;
+    std::string buffer;
+
+    void flushIfFull() {
+        if (buffer.size() >= chunkSize) {
+            flush();
+        }
+    }
+};
+
+void HNSW::exportJsonlIndexChunked(const std::function<void(const char*, size_t)>& sink, size_t chunkSize) {
+    static const char GRAPHLAYER_PREFIX[] = "{\"graphlayer\": ";
+    static const char KEY_PREFIX[] = "{\"key\":";
+    static const char NKEY_PREFIX[] = "{\"nkey\":";
+
     nlohmann::json jsonIndex;
     jsonIndex["distanceFunctionType"] = distanceFunction.nameFunction;
-    jsonIndex["entryPointKey"] = epId;
+    jsonIndex["entryPointKey"] = epId == -1 ? -1 : ids.external(epId);
     jsonIndex["efConstruction"] = efConstruction;
     jsonIndex["m"] = m;
     jsonIndex["mMax0"] = mMax;
@@ -75,41 +196,309 @@ std::string HNSW::exportJsonlIndex() {
     // jsonIndex["useDistanceCache"] = false;
     // jsonIndex["useIndexedDB"] = true;
 
-    std::string jsonlIndex = jsonIndex.dump() + "\n";
+    JsonlChunkWriter writer(sink, chunkSize);
+    writer.line(jsonIndex.dump());
 
     for (int i = 0; i < graphLayers.size(); i++) {
-        jsonlIndex += "{\"graphlayer\": " + std::to_string(i) + "}\n";
-
-        for (const auto& [key, value] : graphLayers[i].graph) {
-            // {"key":"0"}
-            jsonlIndex += "{\"key\":" + std::to_string(key) + "}\n";
-            for (const auto& neighbor : value) {
-                // {"nkey":"1","distance":0.5}
-                jsonlIndex += "{\"nkey\":" + std::to_string(neighbor.iid) 
-                    + ",\"distance\":" + std::to_string(neighbor.distance) + "}\n";
+        writer.idLine(GRAPHLAYER_PREFIX, sizeof(GRAPHLAYER_PREFIX) - 1, i);
+
+        graphLayers[i].freeze();
+        const GraphLayer& graphLayer = graphLayers[i];
+        for (int row = 0; row < graphLayer.size(); ++row) {
+            // {"key":0}
+            writer.idLine(KEY_PREFIX, sizeof(KEY_PREFIX) - 1, ids.external(graphLayer.rowIids[row]));
+            for (int j = graphLayer.offsets[row]; j < graphLayer.offsets[row + 1]; ++j) {
+                // {"nkey":1}, neighbor distances are not stored
+                writer.idLine(NKEY_PREFIX, sizeof(NKEY_PREFIX) - 1, ids.external(graphLayer.neighborIds[j]));
             }
         }
     }
+    writer.flush();
+}
+
+std::string HNSW::exportJsonlIndex() {
+    std::string jsonlIndex;
+    exportJsonlIndexChunked([&jsonlIndex](const char* chunk, size_t length) {
+        jsonlIndex.append(chunk, length);
+    });
     return jsonlIndex;
 }
 
-void HNSW::loadJsonlIndex(const std::string& jsonlIndex) {
-    nlohmann::json indexLine = nlohmann::json::parse(jsonlIndex);
+// Binary index layout (little-endian, every field 4 bytes so all sections stay 4-byte aligned):
+//   header:  "WANN", version, m, efConstruction, mMax, ml, seed, entryPointKey, numIds,
+//            numLayers, embedSize, flags, metric name (length + bytes padded to 4)
+//   layer table: uint64 byte offset of each layer section
+//   ids:     external id of every internal id
+//   layer i: numRows, numEdges, rowIids[numRows], offsets[numRows + 1], neighborIds[numEdges]
+//   vectors: numIds * embedSize floats in internal id order, if flags & BINARY_INDEX_VECTORS
+// Ids inside the layer sections are internal ids, so the arrays load straight into GraphLayer.
+static const char BINARY_INDEX_MAGIC[4] = {'W', 'A', 'N', 'N'};
+static const uint32_t BINARY_INDEX_VERSION = 1;
+static const uint32_t BINARY_INDEX_VECTORS = 1;
+
+class BinaryWriter {
+public:
+    std::string buffer;
+
+    template <typename T>
+    void put(T value) {
+        buffer.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    void putArray(const T* values, size_t count) {
+        buffer.append(reinterpret_cast<const char*>(values), count * sizeof(T));
+    }
+
+    void putString(const std::string& value) {
+        put<uint32_t>(value.size());
+        buffer.append(value);
+        buffer.append((4 - value.size() % 4) % 4, '\0');
+    }
+};
+
+class BinaryReader {
+public:
+    const char* data;
+    size_t size;
+    size_t pos;
+
+    BinaryReader(const char* _data, size_t _size) : data(_data), size(_size), pos(0) {}
+
+    void require(size_t bytes) const {
+        if (bytes > size || pos > size - bytes) {
+            throw std::runtime_error("Truncated binary index");
+        }
+    }
+
+    template <typename T>
+    T get() {
+        require(sizeof(T));
+        T value;
+        std::memcpy(&value, data + pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
+
+    // count values of T fit into the rest of the file; checked before a count read from the file
+    // sizes a vector, so a corrupt count cannot overflow or allocate gigabytes
+    template <typename T>
+    void requireArray(size_t count) const {
+        if (pos > size || count > (size - pos) / sizeof(T)) {
+            throw std::runtime_error("Truncated binary index");
+        }
+    }
+
+    template <typename T>
+    void getArray(T* values, size_t count) {
+        requireArray<T>(count);
+        if (count == 0) { // values may be the data() of an empty vector
+            return;
+        }
+        std::memcpy(values, data + pos, count * sizeof(T));
+        pos += count * sizeof(T);
+    }
+
+    std::string getString() {
+        uint32_t length = get<uint32_t>();
+        require(length);
+        std::string value(data + pos, length);
+        pos += length + (4 - length % 4) % 4;
+        return value;
+    }
+};
+
+std::string HNSW::exportBinaryIndex(bool withVectors) {
+    int embedSize = nodes.getEmbedSize();
+    if (embedSize == 0) {
+        withVectors = false;
+    }
+
+    freezeGraph();
+
+    BinaryWriter writer;
+    writer.putArray(BINARY_INDEX_MAGIC, 4);
+    writer.put<uint32_t>(BINARY_INDEX_VERSION);
+    writer.put<int32_t>(m);
+    writer.put<int32_t>(efConstruction);
+    writer.put<int32_t>(mMax);
+    writer.put<float>(ml);
+    writer.put<float>(seed);
+    writer.put<int32_t>(epId == -1 ? -1 : ids.external(epId));
+    writer.put<uint32_t>(ids.size());
+    writer.put<uint32_t>(graphLayers.size());
+    writer.put<uint32_t>(embedSize);
+    writer.put<uint32_t>(withVectors ? BINARY_INDEX_VECTORS : 0);
+    writer.putString(distanceFunction.nameFunction);
+
+    size_t layerTablePos = writer.buffer.size();
+    writer.buffer.append(graphLayers.size() * 2 * sizeof(uint32_t), '\0');
+
+    for (int iid = 0; iid < ids.size(); ++iid) {
+        writer.put<int32_t>(ids.external(iid));
+    }
+
+    for (int i = 0; i < graphLayers.size(); ++i) {
+        uint64_t layerPos = writer.buffer.size();
+        std::memcpy(&writer.buffer[layerTablePos + i * 8], &layerPos, sizeof(uint64_t));
+
+        const GraphLayer& graphLayer = graphLayers[i];
+        writer.put<uint32_t>(graphLayer.size());
+        writer.put<uint32_t>(graphLayer.neighborIds.size());
+        writer.putArray(graphLayer.rowIids.data(), graphLayer.rowIids.size());
+        writer.putArray(graphLayer.offsets.data(), graphLayer.offsets.size());
+        writer.putArray(graphLayer.neighborIds.data(), graphLayer.neighborIds.size());
+    }
+
+    if (withVectors && isQuantized(nodes.getVectorEncoding())) {
+        // the cache only holds quantized rows, write the full-precision vectors from the store
+        const int batchSize = 256;
+        for (int start = 0; start < ids.size(); start += batchSize) {
+            std::vector<int> batch(std::min(batchSize, ids.size() - start));
+            std::iota(batch.begin(), batch.end(), start);
+            std::unordered_map<int, std::vector<float>> values = nodes.bulkGetFromDB(batch);
+            for (int iid : batch) {
+                auto it = values.find(iid);
+                if (it == values.end()) {
+                    throw std::runtime_error("Vector of node " + std::to_string(ids.external(iid)) + " is not available");
+                }
+                writer.putArray(it->second.data(), embedSize);
+            }
+        }
+    }
+    else if (withVectors) {
+        std::vector<float> scratch;
+        for (int iid = 0; iid < ids.size(); ++iid) {
+            VectorView value = nodes.get(iid);
+            if (value.empty()) {
+                throw std::runtime_error("Vector of node " + std::to_string(ids.external(iid)) + " is not available");
+            }
+            writer.putArray(floatsOf(value, scratch), embedSize);
+        }
+    }
+
+    return writer.buffer;
+}
+
+void HNSW::loadBinaryIndex(const char* data, size_t size) {
+    BinaryReader reader(data, size);
+
+    char magic[4];
+    reader.getArray(magic, 4);
+    if (std::memcmp(magic, BINARY_INDEX_MAGIC, 4) != 0) {
+        throw std::runtime_error("Not a binary index");
+    }
+    uint32_t version = reader.get<uint32_t>();
+    if (version != BINARY_INDEX_VERSION) {
+        throw std::runtime_error("Unsupported binary index version " + std::to_string(version));
+    }
+
+    clear(); // a load that fails past this point leaves an empty index
+
+    m = reader.get<int32_t>();
+    efConstruction = reader.get<int32_t>();
+    mMax = reader.get<int32_t>();
+    ml = reader.get<float>();
+    seed = reader.get<float>();
+    rng.seed(static_cast<unsigned int>(seed));
+    uniformDist = std::uniform_real_distribution<float>(0.0, 1.0);
+    int entryPointKey = reader.get<int32_t>();
+    uint32_t numIds = reader.get<uint32_t>();
+    uint32_t numLayers = reader.get<uint32_t>();
+    uint32_t embedSize = reader.get<uint32_t>();
+    uint32_t flags = reader.get<uint32_t>();
+    distanceFunction.setFunction(reader.getString());
+
+    reader.requireArray<uint64_t>(numLayers);
+    std::vector<uint64_t> layerPositions(numLayers);
+    reader.getArray(layerPositions.data(), numLayers);
+
+    reader.requireArray<int32_t>(numIds);
+    std::vector<int32_t> externalIds(numIds);
+    reader.getArray(externalIds.data(), numIds);
+    for (int externalId : externalIds) {
+        ids.getOrAdd(externalId); // internal ids follow the file order
+    }
+    if ((uint32_t)ids.size() != numIds) {
+        throw std::runtime_error("Binary index repeats an external id");
+    }
+    epId = entryPointKey == -1 ? -1 : ids.find(entryPointKey);
+
+    for (uint32_t i = 0; i < numLayers; ++i) {
+        reader.pos = layerPositions[i];
+        uint32_t numRows = reader.get<uint32_t>();
+        uint32_t numEdges = reader.get<uint32_t>();
+
+        reader.requireArray<int32_t>(numRows); // rowIids, the offsets and edges are checked below
+        reader.requireArray<int32_t>(numEdges);
 
-    if (indexLine.contains("graphlayer")) { // start a new graph layer
         GraphLayer newGraphLayer;
-        graphLayers.push_back(newGraphLayer);
+        newGraphLayer.rowIids.resize(numRows);
+        newGraphLayer.offsets.resize(numRows + 1);
+        newGraphLayer.neighborIds.resize(numEdges);
+        reader.getArray(newGraphLayer.rowIids.data(), numRows);
+        reader.getArray(newGraphLayer.offsets.data(), numRows + 1);
+        reader.getArray(newGraphLayer.neighborIds.data(), numEdges);
+        newGraphLayer.loadFrozen(numIds);
+        graphLayers.push_back(std::move(newGraphLayer));
+    }
+
+    if ((flags & BINARY_INDEX_VECTORS) && numIds > 0) {
+        reader.requireArray<float>(embedSize); // every row is checked again as it is read
+        checkDimension(embedSize);
+        std::vector<float> value(embedSize);
+        for (uint32_t iid = 0; iid < numIds; ++iid) {
+            reader.getArray(value.data(), embedSize);
+            nodes.add(iid, value);
+        }
+    }
+}
+
+// iid of a key value: a number, a numeric string or "<iid>@@<suffix>" (same rule as WRAG.key2id)
+static int scanJsonlKey(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == ':' || *p == '"')) {
+        ++p;
     }
-    else if (indexLine.contains("key")) {
-        int qId = indexLine["key"].get<int>();
+    bool negative = p < end && *p == '-';
+    if (negative) {
+        ++p;
+    }
+    if (p == end || *p < '0' || *p > '9') {
+        throw std::invalid_argument("Invalid key in JSONL index line");
+    }
+    int value = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        value = value * 10 + (*p - '0');
+        ++p;
+    }
+    return negative ? -value : value;
+}
+
+static int jsonKey(const nlohmann::json& value) {
+    if (value.is_string()) {
+        const std::string& key = value.get_ref<const std::string&>();
+        return scanJsonlKey(key.data(), key.data() + key.size());
+    }
+    return value.get<int>();
+}
+
+// Graph lines only need one field, so they are scanned by hand; "nkey" lines may also carry a
+// "distance" that the index does not use. Only the metadata line goes through the JSON parser.
+void HNSW::loadJsonlLine(std::string_view line) {
+    size_t pos;
+    if ((pos = line.find("\"nkey\"")) != std::string_view::npos) {
+        int nId = ids.getOrAdd(scanJsonlKey(line.data() + pos + 6, line.data() + line.size()));
+        graphLayers.back().addNeighbor(nId);
+    }
+    else if ((pos = line.find("\"key\"")) != std::string_view::npos) {
+        int qId = ids.getOrAdd(scanJsonlKey(line.data() + pos + 5, line.data() + line.size()));
         graphLayers.back().addQId(qId);
     }
-    else if (indexLine.contains("nkey")) {
-        int nId = indexLine["nkey"].get<int>();
-        float distance = indexLine["distance"].get<float>();
-        graphLayers.back().addNeighbor(Candidate(nId, distance));
+    else if (line.find("\"graphlayer\"") != std::string_view::npos) { // start a new graph layer
+        graphLayers.emplace_back();
     }
-    else { // meta data
+    else if (line.find_first_not_of(" \t\r") != std::string_view::npos) { // meta data
+        nlohmann::json indexLine = nlohmann::json::parse(line.begin(), line.end());
         m = indexLine["m"].get<int>();
         efConstruction = indexLine["efConstruction"].get<int>();
         mMax = indexLine["mMax0"].get<int>();
@@ -117,8 +506,58 @@ void HNSW::loadJsonlIndex(const std::string& jsonlIndex) {
         seed = indexLine["seed"].get<float>();
         rng.seed(static_cast<unsigned int>(seed));
         uniformDist = std::uniform_real_distribution<float>(0.0, 1.0);
-        distanceFunction.nameFunction = indexLine["distanceFunctionType"].get<std::string>();
-        epId = indexLine["entryPointKey"].get<int>();
+        distanceFunction.setFunction(indexLine["distanceFunctionType"].get<std::string>());
+        int entryPointKey = jsonKey(indexLine["entryPointKey"]);
+        epId = entryPointKey == -1 ? -1 : ids.getOrAdd(entryPointKey); // -1: exported while empty
+    }
+}
+
+void HNSW::loadJsonlIndex(const std::string& jsonlIndex) {
+    loadJsonlLine(jsonlIndex);
+}
+
+void HNSW::loadJsonlIndexChunk(const char* chunk, size_t length, bool last) {
+    if (TIMER){
+        timers.start("load_jsonl_chunk");
+    }
+
+    const char* end = chunk + length;
+    const char* lineStart = chunk;
+    const char* newline;
+    if (!jsonlPending.empty()) { // finish the line cut by the previous chunk
+        newline = length > 0 ? static_cast<const char*>(std::memchr(chunk, '\n', length)) : nullptr;
+        const char* lineEnd = newline != nullptr ? newline : end;
+        jsonlPending.append(chunk, lineEnd - chunk);
+        if (newline != nullptr || last) {
+            std::string line;
+            line.swap(jsonlPending);
+            loadJsonlLine(line);
+        }
+        lineStart = newline != nullptr ? newline + 1 : end;
+    }
+
+    while (lineStart < end) {
+        newline = static_cast<const char*>(std::memchr(lineStart, '\n', end - lineStart));
+        if (newline == nullptr) {
+            break;
+        }
+        loadJsonlLine(std::string_view(lineStart, newline - lineStart));
+        lineStart = newline + 1;
+    }
+
+    if (lineStart < end) {
+        if (last) {
+            loadJsonlLine(std::string_view(lineStart, end - lineStart));
+        } else {
+            jsonlPending.assign(lineStart, end - lineStart);
+        }
+    }
+    if (last) {
+        freezeGraph();
+    }
+
+    if (TIMER){
+        timers.end("load_jsonl_chunk");
     }
 }
 
@@ -135,44 +574,80 @@ void HNSW::loadIndex(const std::string& jsonString) {
     rng.seed(static_cast<unsigned int>(seed));
     uniformDist = std::uniform_real_distribution<float>(0.0, 1.0);
 
-    distanceFunction.nameFunction = jsonIndex["distanceFunctionType"].get<std::string>();
+    distanceFunction.setFunction(jsonIndex["distanceFunctionType"].get<std::string>());
 
-    epId = jsonIndex["entryPointKey"].get<int>();
+    int entryPointKey = jsonIndex["entryPointKey"].get<int>();
+    epId = entryPointKey == -1 ? -1 : ids.getOrAdd(entryPointKey); // -1: exported while empty
     
     // load graphLayers
     for (const auto& jsonGraphLayer : jsonIndex["graphLayers"]) {
         GraphLayer newGraphLayer;
         for (const auto& [key, value] : jsonGraphLayer.items()) {
             std::vector<Candidate> neighbors;
-            int qId = std::stoi(key);
-            for (const auto& [neighborId, distance] : value.items()) {
-                int nId = std::stoi(neighborId);
-                neighbors.push_back(Candidate(nId, distance));
+            int qId = ids.getOrAdd(std::stoi(key));
+            for (const auto& [neighborId, distance] : value.items()) { // distances are ignored
+                int nId = ids.getOrAdd(std::stoi(neighborId));
+                neighbors.push_back(Candidate(nId, 0));
             }
-            newGraphLayer.graph[qId] = neighbors;
+            newGraphLayer.setNeighbors(qId, neighbors);
         }
+        newGraphLayer.freeze();
         graphLayers.push_back(newGraphLayer);
     }
 }
 
-void HNSW::insertSkipIndex(const int qId, const std::vector<float>& value, int layer) {
+void HNSW::checkDimension(int dimension) {
+    if (dimension <= 0 || (getDimension() > 0 && dimension != getDimension())) {
+        throw std::invalid_argument("Vector has " + std::to_string(dimension) + " dimensions, the index has " +
+            std::to_string(getDimension()));
+    }
+    distanceFunction.setDimension(dimension);
+}
+
+int HNSW::getDimension() const {
+    return distanceFunction.getDimension() > 0 ? distanceFunction.getDimension() : nodes.getEmbedSize();
+}
+
+void HNSW::checkQueryDimension(int dimension) const {
+    if (getDimension() > 0 && dimension != getDimension()) {
+        throw std::invalid_argument("Vectors must be of the same length");
+    }
+}
+
+void HNSW::insertSkipIndex(const int externalId, const std::vector<float>& value, int layer) {
+    checkDimension(value.size());
+    const int qId = ids.getOrAdd(externalId);
     if (nodes.has(qId)) {
-        std::cout << "There is already a node with id " << qId << " in the index." << std::endl;
+        std::cout << "There is already a node with id " << externalId << " in the index." << std::endl;
         return;
         // throw std::runtime_error("There is already a node with id " + std::to_string(qId) + " in the index.");
     }
-    nodes.set(qId, value);
+    nodes.add(qId, value);
+    if (pq.trained()) {
+        pqEncode(qId, value.data());
+    }
+    if (signCodes.trained()) {
+        signCodes.encode(qId, value.data());
+    }
 }
 
-int HNSW::insert(const int qId, const std::vector<float>& value, int maxLayer) {
+int HNSW::insert(const int externalId, const std::vector<float>& value, int maxLayer) {
 
+    checkDimension(value.size());
     int layer = maxLayer == -1 ? getRandomLayer() : maxLayer;
 
+    const int qId = ids.getOrAdd(externalId);
     if (nodes.has(qId)) {
-        throw std::runtime_error("There is already a node with id " + std::to_string(qId) + " in the index.");
+        throw std::runtime_error("There is already a node with id " + std::to_string(externalId) + " in the index.");
     }
 
-    nodes.set(qId, value);
+    nodes.add(qId, value);
+    if (pq.trained()) {
+        pqEncode(qId, value.data());
+    }
+    if (signCodes.trained()) {
+        signCodes.encode(qId, value.data());
+    }
 
     if (TIMER){
         timers.start("insert_to_graph");
@@ -180,11 +655,11 @@ int HNSW::insert(const int qId, const std::vector<float>& value, int maxLayer) {
 
     if (epId != -1) {
         // if the epId is in indexedDB
-        std::vector<float> epValue = nodes.get(epId);
-        if (epValue.size() == 0) {
+        VectorView epValue = nodes.get(epId);
+        if (epValue.empty()) {
             return -1; // epId is not in indexedDB
         }
-        Candidate ep = Candidate(epId, calDistance(value, epValue));
+        Candidate ep = Candidate(epId, calDistance(value.data(), epValue));
 
         // (1) Search layers above
         for (int l = graphLayers.size() - 1; l >= layer + 1; --l) {
@@ -201,18 +676,24 @@ int HNSW::insert(const int qId, const std::vector<float>& value, int maxLayer) {
             selectedNeighbors = selectNeighborsHeuristic(eps, layerM);
 
             // Update the neighbors of the new node
-            graphLayers[l].graph[qId] = selectedNeighbors;
+            graphLayers[l].setNeighbors(qId, selectedNeighbors);
 
             // Update the neighbors of the selected neighbors
             for (const auto& neighbor : selectedNeighbors) {
-                std::vector<Candidate> & neighborNode = graphLayers[l].graph.at(neighbor.iid); // Maybe empty
-                neighborNode.push_back(Candidate(qId, neighbor.distance));
+                std::vector<int> & neighborNode = graphLayers[l].mutableNeighbors(neighbor.iid); // Maybe empty
+                neighborNode.push_back(qId);
 
                 if (neighborNode.size() > mMax) { // May cause non-bidirectional links
                     std::vector<Candidate> snh = selectNeighborsHeuristic(
-                        neighborNode, mMax
+                        neighborCandidates(neighbor.iid, neighborNode), mMax
                     );
-                    graphLayers[l].graph[neighbor.iid] = snh;
+                    if (snh.empty()) {
+                        continue; // vectors unavailable, keep the unpruned list
+                    }
+                    neighborNode.clear();
+                    for (const auto& selected : snh) {
+                        neighborNode.push_back(selected.iid);
+                    }
                 }
             }
         }
@@ -232,7 +713,406 @@ int HNSW::insert(const int qId, const std::vector<float>& value, int maxLayer) {
 }
 
 
+void HNSW::insertBatch(const int* externalIds, const float* values, int count, int dimension) {
+    if (count == 0) {
+        return;
+    }
+    checkDimension(dimension);
+    if (buildThreads != 1) {
+        insertParallel(externalIds, values, count, dimension, buildThreads);
+        return;
+    }
+
+    if (TIMER){
+        timers.start("insert_batch");
+    }
+
+    std::vector<float> value(dimension);
+    for (int i = 0; i < count; ++i) {
+        value.assign(values + (size_t)i * dimension, values + (size_t)(i + 1) * dimension);
+        insert(externalIds[i], value);
+    }
+
+    if (TIMER){
+        timers.end("insert_batch");
+    }
+}
+
+
+struct HNSW::ParallelGraph {
+    static constexpr int NUM_LOCKS = 1 << 12; // striped by iid, a power of two
+
+    std::vector<VectorView> rows; // resident row of every internal id in the graph
+    std::mutex nodeLocks[NUM_LOCKS]; // guard the neighbor lists of their nodes in every layer
+    std::mutex levelLock; // held through the insertion of a node that raises the top layer
+    // published in this order, so a reader that loads maxLevel first finds an entry point in it
+    std::atomic<int> entryPoint{-1};
+    std::atomic<int> maxLevel{-1};
+    std::atomic<long> distances{0}; // computed by the workers, added to distanceCount at the end
+
+    std::mutex& lockOf(int iid) {
+        return nodeLocks[iid & (NUM_LOCKS - 1)];
+    }
+
+    // copy of the neighbor list of iid, another worker may be rewriting it
+    void neighbors(const GraphLayer& graphLayer, int iid, std::vector<int>& neighborIds) {
+        std::lock_guard<std::mutex> guard(lockOf(iid));
+        NeighborView view = graphLayer.neighbors(iid);
+        neighborIds.assign(view.ids, view.ids + view.count);
+    }
+
+    // workers count into a local and add it once per call, not once per distance
+    void countDistances(long evaluations) {
+        if (DISTANCECOUNTER) {
+            distances.fetch_add(evaluations, std::memory_order_relaxed);
+        }
+    }
+};
+
+// Runs body(i, visited) for every i in [begin, end) on numThreads threads (0: one per core), the
+// calling thread included; each thread takes the next i and has its own VisitedList. The first
+// exception thrown by body stops the others and is rethrown here once all have joined.
+static void parallelFor(int begin, int end, int numThreads, const std::function<void(int, VisitedList&)>& body) {
+    if (numThreads <= 0) {
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+    numThreads = 1; // built without -pthread, see compile.sh
+#endif
+
+    std::atomic<int> next(begin);
+    std::atomic<bool> failed(false);
+    std::exception_ptr error;
+    std::mutex errorLock;
+    auto work = [&]() {
+        VisitedList visited;
+        try {
+            for (int i = next++; i < end && !failed; i = next++) {
+                body(i, visited);
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> guard(errorLock);
+            if (!error) {
+                error = std::current_exception();
+            }
+            failed = true;
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int t = 1; t < numThreads; ++t) {
+        workers.emplace_back(work);
+    }
+    work();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+bool HNSW::snapshotResidentRows(ParallelGraph& shared) {
+    const std::vector<int>& graphIids = graphLayers[0].rowIids;
+    if (nodes.getItemsThreshold() < (int)graphIids.size()) {
+        return false;
+    }
+    std::vector<int> missing;
+    for (int iid : graphIids) {
+        if (!nodes.has(iid)) {
+            missing.push_back(iid);
+        }
+    }
+    if (!missing.empty()) { // one store call, not one per row
+        for (const auto& [iid, value] : nodes.bulkGetFromDB(missing)) {
+            nodes.set(iid, value);
+        }
+    }
+    shared.rows.assign(ids.size(), VectorView());
+    for (int iid : graphIids) {
+        shared.rows[iid] = nodes.peek(iid);
+        if (shared.rows[iid].empty()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Three steps:
+// (1) check the batch and load the rows of the existing graph, failing before the index changes;
+//     then serially assign ids, store the vectors, draw the layers and add a row for every new node
+//     to each of its layers, then thaw every row, so the workers never resize a layer;
+// (2) snapshotResidentRows, nothing is admitted or evicted afterwards, so the workers skip the cache;
+// (3) the workers take the nodes in order and link them like insert does.
+void HNSW::insertParallel(const int* externalIds, const float* values, int count, int dimension, int numThreads) {
+    if (count == 0) {
+        return;
+    }
+    checkDimension(dimension);
+    if (nodes.getEmbedSize() == 0) {
+        nodes.setEmbedSize(dimension);
+    }
+
+    // the rows of the graph are loaded first, so ids already in the index are found by has()
+    auto shared = std::make_unique<ParallelGraph>();
+    if (epId != -1 && !snapshotResidentRows(*shared)) {
+        throw std::runtime_error("Parallel build needs every vector resident in the Wasm cache, raise the items threshold");
+    }
+    std::unordered_set<int> batchIds;
+    int newIds = 0;
+    for (int i = 0; i < count; ++i) {
+        int iid = ids.find(externalIds[i]);
+        if ((iid != -1 && nodes.has(iid)) || !batchIds.insert(externalIds[i]).second) {
+            throw std::runtime_error("There is already a node with id " + std::to_string(externalIds[i]) + " in the index.");
+        }
+        newIds += iid == -1;
+    }
+    const int needed = ids.size() + newIds;
+    if (nodes.getItemsThreshold() < needed) {
+        throw std::invalid_argument("Parallel build needs room for " + std::to_string(needed) +
+            " vectors in the Wasm cache, raise the items threshold or the Wasm memory");
+    }
+
+    if (TIMER){
+        timers.start("insert_parallel");
+    }
+
+    int first = 0;
+    if (epId == -1) { // an empty graph starts with one node
+        insert(externalIds[0], std::vector<float>(values, values + dimension));
+        first = 1;
+    }
+
+    const int oldTopLayer = graphLayers.size() - 1;
+    int topLayer = oldTopLayer;
+    std::vector<int> qIds(count), layers(count);
+    for (int i = first; i < count; ++i) {
+        layers[i] = getRandomLayer();
+        topLayer = std::max(topLayer, layers[i]);
+        qIds[i] = ids.getOrAdd(externalIds[i]);
+        const float* value = values + (size_t)i * dimension;
+        nodes.add(qIds[i], std::vector<float>(value, value + dimension));
+        if (pq.trained()) {
+            pqEncode(qIds[i], value);
+        }
+        if (signCodes.trained()) {
+            signCodes.encode(qIds[i], value);
+        }
+    }
+
+    for (int l = graphLayers.size(); l <= topLayer; ++l) {
+        graphLayers.push_back(GraphLayer());
+    }
+    for (int i = first; i < count; ++i) {
+        for (int l = 0; l <= layers[i]; ++l) {
+            graphLayers[l].addNode(qIds[i]);
+        }
+    }
+    for (auto& graphLayer : graphLayers) {
+        graphLayer.thawAll();
+    }
+
+    if (!snapshotResidentRows(*shared)) { // the room was checked above, only the views are taken
+        throw std::runtime_error("Parallel build needs every vector resident in the Wasm cache, raise the items threshold");
+    }
+    shared->entryPoint.store(epId);
+    shared->maxLevel.store(oldTopLayer);
+
+    parallelFor(first, count, numThreads, [&](int i, VisitedList& visited) {
+        parallelInsert(*shared, qIds[i], values + (size_t)i * dimension, layers[i], visited);
+    });
+
+    epId = shared->entryPoint.load();
+    distanceCount += shared->distances.load();
+    freezeGraph(); // every row was thawed, pack them again
+
+    if (TIMER){
+        timers.end("insert_parallel");
+    }
+}
+
+void HNSW::parallelInsert(ParallelGraph& shared, const int qId, const float* qValue, int layer, VisitedList& visited) {
+    // a node above the top layer keeps the level lock until it is the new entry point, the
+    // others only take it to find out they do not need it
+    std::unique_lock<std::mutex> levelGuard(shared.levelLock, std::defer_lock);
+    int maxLevel = shared.maxLevel.load(std::memory_order_acquire);
+    if (layer > maxLevel) {
+        levelGuard.lock();
+        maxLevel = shared.maxLevel.load(std::memory_order_acquire);
+        if (layer <= maxLevel) {
+            levelGuard.unlock();
+        }
+    }
+    const int entryPoint = shared.entryPoint.load(std::memory_order_acquire);
+
+    Candidate ep = Candidate(entryPoint, distanceFunction.calculate(qValue, shared.rows[entryPoint]));
+    long evaluations = 1;
+    for (int l = maxLevel; l >= layer + 1; --l) {
+        ep = parallelSearchLayerGreedy(shared, qValue, ep, l);
+    }
+
+    std::vector<Candidate> eps = { ep };
+    std::vector<float> decoded;
+    for (int l = std::min(maxLevel, layer); l >= 0; --l) {
+        int layerM = l == 0 ? mMax : m;
+
+        eps = parallelSearchLayer(shared, qId, qValue, eps, l, efConstruction, visited);
+        std::vector<Candidate> selectedNeighbors = parallelSelectNeighbors(shared, eps, layerM);
+
+        {
+            std::lock_guard<std::mutex> guard(shared.lockOf(qId));
+            graphLayers[l].setNeighbors(qId, selectedNeighbors);
+        }
+
+        for (const auto& neighbor : selectedNeighbors) {
+            std::lock_guard<std::mutex> guard(shared.lockOf(neighbor.iid));
+            std::vector<int>& neighborNode = graphLayers[l].mutableNeighbors(neighbor.iid);
+            neighborNode.push_back(qId);
+
+            if (neighborNode.size() > mMax) {
+                const float* neighborValue = floatsOf(shared.rows[neighbor.iid], decoded);
+                std::vector<Candidate> candidates;
+                for (int nId : neighborNode) {
+                    candidates.push_back(Candidate(nId, distanceFunction.calculate(neighborValue, shared.rows[nId])));
+                }
+                evaluations += neighborNode.size();
+                std::vector<Candidate> snh = parallelSelectNeighbors(shared, candidates, mMax);
+                neighborNode.clear();
+                for (const auto& selected : snh) {
+                    neighborNode.push_back(selected.iid);
+                }
+            }
+        }
+    }
+
+    shared.countDistances(evaluations);
+
+    if (levelGuard.owns_lock()) {
+        shared.entryPoint.store(qId, std::memory_order_release);
+        shared.maxLevel.store(layer, std::memory_order_release);
+    }
+}
+
+Candidate HNSW::parallelSearchLayerGreedy(ParallelGraph& shared, const float* qValue, Candidate minCandidate, int layer) {
+    const GraphLayer& graphLayer = graphLayers[layer];
+    std::vector<int> neighborIds;
+    long evaluations = 0;
+
+    bool moved = true;
+    while (moved) {
+        moved = false;
+        shared.neighbors(graphLayer, minCandidate.iid, neighborIds);
+        evaluations += neighborIds.size();
+        for (int nId : neighborIds) {
+            float distance = distanceFunction.calculate(qValue, shared.rows[nId]);
+            if (distance < minCandidate.distance) {
+                minCandidate = Candidate(nId, distance);
+                moved = true;
+            }
+        }
+    }
+
+    shared.countDistances(evaluations);
+    return minCandidate;
+}
+
+std::vector<Candidate> HNSW::parallelSearchLayer(ParallelGraph& shared, const int qId, const float* qValue,
+const std::vector<Candidate>& entryPoints, int layer, int ef, VisitedList& visited) {
+
+    const GraphLayer& graphLayer = graphLayers[layer];
+
+    std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> candidateMinHeap;
+    std::priority_queue<Candidate> foundNodesMaxHeap;
+
+    visited.reset(ids.size());
+    if (qId != -1) {
+        visited.visit(qId); // its row exists already, but it is never its own neighbor
+    }
+
+    for (const auto& searchNode : entryPoints) {
+        candidateMinHeap.push(searchNode);
+        foundNodesMaxHeap.push(searchNode);
+        visited.visit(searchNode.iid);
+    }
+
+    std::vector<int> neighborIds;
+    long evaluations = 0;
+    while (!candidateMinHeap.empty()) {
+        Candidate nearestCandidate = candidateMinHeap.top();
+        candidateMinHeap.pop();
+
+        if (nearestCandidate.distance > foundNodesMaxHeap.top().distance) {
+            break;
+        }
+
+        shared.neighbors(graphLayer, nearestCandidate.iid, neighborIds);
+        for (int neighborId : neighborIds) {
+            if (visited.visited(neighborId)) {
+                continue;
+            }
+            visited.visit(neighborId);
+
+            float distance = distanceFunction.calculate(qValue, shared.rows[neighborId]);
+            ++evaluations;
+            if (foundNodesMaxHeap.size() < ef || distance < foundNodesMaxHeap.top().distance) {
+                foundNodesMaxHeap.push(Candidate(neighborId, distance));
+                candidateMinHeap.push(Candidate(neighborId, distance));
+
+                if (foundNodesMaxHeap.size() > ef) {
+                    foundNodesMaxHeap.pop();
+                }
+            }
+        }
+    }
+
+    shared.countDistances(evaluations);
+
+    std::vector<Candidate> result; // sorted by distance, from furthest to nearest
+    while (!foundNodesMaxHeap.empty()) {
+        result.push_back(foundNodesMaxHeap.top());
+        foundNodesMaxHeap.pop();
+    }
+    return result;
+}
+
+std::vector<Candidate> HNSW::parallelSelectNeighbors(ParallelGraph& shared, const std::vector<Candidate>& candidates, int maxSize) {
+    if (candidates.size() < maxSize) {
+        return candidates; // unsorted
+    }
+
+    std::vector<Candidate> sorted = candidates;
+    std::sort(sorted.begin(), sorted.end());
+
+    std::vector<Candidate> selectedNeighbors;
+    std::vector<float> decoded;
+    long evaluations = 0;
+    for (const auto& candidate : sorted) {
+        if (selectedNeighbors.size() >= maxSize) {
+            break;
+        }
+
+        const float* candidateValue = floatsOf(shared.rows[candidate.iid], decoded);
+        bool isCandidateFarFromExistingNeighbors = true;
+        for (const auto& selectedNeighbor : selectedNeighbors) {
+            ++evaluations;
+            if (distanceFunction.calculate(candidateValue, shared.rows[selectedNeighbor.iid]) < candidate.distance) {
+                isCandidateFarFromExistingNeighbors = false;
+                break;
+            }
+        }
+
+        if (isCandidateFarFromExistingNeighbors) {
+            selectedNeighbors.push_back(candidate);
+        }
+    }
+
+    shared.countDistances(evaluations);
+    return selectedNeighbors; // sorted by distance
+}
+
 void HNSW::query( const std::vector<float>& value, int k, int efc ) {
+    checkQueryDimension(value.size());
+
     if (TIMER){
         timers.start("query");
     }
@@ -245,15 +1125,36 @@ void HNSW::query( const std::vector<float>& value, int k, int efc ) {
         throw std::runtime_error("Index is not initialized yet");
     }
 
-    std::vector<float> epValue = nodes.get(epId);
-    Candidate ep = Candidate(epId, calDistance(value, epValue));
+    freezeGrownLayers();
+
+    // traverse on the in-memory PQ codes or prefilter on sign codes, both are dropped again when
+    // query returns; PQ lookups are already cheaper than what the prefilter would save
+    const bool scoreOnCodes = pqSearch && pq.trained();
+    struct QueryCodesReset {
+        std::vector<float>& table;
+        bool& signActive;
+        ~QueryCodesReset() { table.clear(); signActive = false; }
+    } queryCodesReset{pqTable, signQueryActive};
+    if (scoreOnCodes) {
+        preparePQTable(value.data());
+    }
+    else if (signPrefilter && signCodes.trained()) {
+        signCodes.prepare(value.data(), signQuery);
+        signQueryActive = true;
+    }
+
+    float epDistance;
+    if (!scoreNode(value.data(), epId, false, epDistance)) {
+        throw std::runtime_error("Vector of the entry point " + std::to_string(ids.external(epId)) + " is not available");
+    }
+    Candidate ep = Candidate(epId, epDistance);
 
     for (int l = graphLayers.size() - 1; l >= 1; l--) {
         ep = searchLayerGreedy(-1, value, ep, l);
     }
 
     std::vector<Candidate> candidates = { ep };
-    if (lazyLoading) {
+    if (lazyLoading && !scoreOnCodes) { // codes are all resident, nothing to load lazily
         candidates = searchLayerLazyLoading(-1, value, candidates, 0, efc);
     }
     else {
@@ -262,10 +1163,23 @@ void HNSW::query( const std::vector<float>& value, int k, int efc ) {
 
     std::sort(candidates.begin(), candidates.end());
 
+    if (scoreOnCodes || isQuantized(nodes.getVectorEncoding())) {
+        // quantized distances only rank approximately, so rerank a few more than k
+        if (k != -1) {
+            int factor = scoreOnCodes ? pqRerankFactor : rerankFactor;
+            candidates.resize(std::min(k * factor, (int)candidates.size()));
+        }
+        rerank(value, candidates);
+    }
+
     if (k != -1) {
         candidates.resize(std::min(k, (int)candidates.size()));
     }
 
+    for (auto& candidate : candidates) {
+        candidate.iid = ids.external(candidate.iid);
+    }
+
     if (TIMER){
         timers.end("query");
     }
@@ -273,6 +1187,332 @@ void HNSW::query( const std::vector<float>& value, int k, int efc ) {
     globalQueryResults = candidates;
 }
 
+void HNSW::queryBatch(const float* values, int nq, int dimension, int k, int efc, int* resultIds, float* resultDistances) {
+    if (k <= 0) {
+        throw std::invalid_argument("queryBatch expects k > 0, the results are k slots per query");
+    }
+    checkQueryDimension(dimension);
+    const bool scoreOnCodes = (pqSearch && pq.trained()) || (signPrefilter && signCodes.trained());
+    if (queryThreads != 1 && !scoreOnCodes && queryParallel(values, nq, dimension, k, efc, resultIds, resultDistances)) {
+        return;
+    }
+
+    std::vector<float> value(dimension);
+    for (int q = 0; q < nq; ++q) {
+        value.assign(values + (size_t)q * dimension, values + (size_t)(q + 1) * dimension);
+        query(value, k, efc);
+        for (int i = 0; i < k; ++i) {
+            bool found = i < (int)globalQueryResults.size();
+            resultIds[(size_t)q * k + i] = found ? globalQueryResults[i].iid : -1;
+            resultDistances[(size_t)q * k + i] = found ? globalQueryResults[i].distance : std::numeric_limits<float>::infinity();
+        }
+    }
+}
+
+// The graph and the snapshotted rows are only read, each worker searches one query at a time with
+// its own VisitedList and heaps and leaves its shortlist in the query's slot. Quantized rows are
+// reranked afterwards on this thread, which may have to fetch vectors from the store.
+bool HNSW::queryParallel(const float* values, int nq, int dimension, int k, int efc, int* resultIds, float* resultDistances) {
+    if (k <= 0) {
+        throw std::invalid_argument("queryParallel expects k > 0, the results are k slots per query");
+    }
+    checkQueryDimension(dimension);
+    if (epId == -1) {
+        throw std::runtime_error("Index is not initialized yet");
+    }
+    if (efc == -1) {
+        efc = efConstruction;
+    }
+
+    freezeGrownLayers();
+    auto shared = std::make_unique<ParallelGraph>();
+    if (!snapshotResidentRows(*shared)) {
+        return false;
+    }
+
+    if (TIMER){
+        timers.start("query_parallel");
+    }
+
+    const bool quantized = isQuantized(nodes.getVectorEncoding());
+    const int shortlist = quantized ? k * rerankFactor : k;
+    std::vector<std::vector<Candidate>> slots(nq);
+    parallelFor(0, nq, queryThreads, [&](int q, VisitedList& visited) {
+        const float* qValue = values + (size_t)q * dimension;
+        Candidate ep = Candidate(epId, distanceFunction.calculate(qValue, shared->rows[epId]));
+        shared->countDistances(1);
+        for (int l = graphLayers.size() - 1; l >= 1; --l) {
+            ep = parallelSearchLayerGreedy(*shared, qValue, ep, l);
+        }
+        std::vector<Candidate> candidates = parallelSearchLayer(*shared, -1, qValue, { ep }, 0, efc, visited);
+        std::sort(candidates.begin(), candidates.end());
+        candidates.resize(std::min(shortlist, (int)candidates.size()));
+        slots[q] = std::move(candidates);
+    });
+
+    distanceCount += shared->distances.load();
+
+    for (int q = 0; q < nq; ++q) {
+        std::vector<Candidate>& candidates = slots[q];
+        if (quantized) {
+            rerank(std::vector<float>(values + (size_t)q * dimension, values + (size_t)(q + 1) * dimension), candidates);
+            candidates.resize(std::min(k, (int)candidates.size()));
+        }
+        for (int i = 0; i < k; ++i) {
+            bool found = i < (int)candidates.size();
+            resultIds[(size_t)q * k + i] = found ? ids.external(candidates[i].iid) : -1;
+            resultDistances[(size_t)q * k + i] = found ? candidates[i].distance : std::numeric_limits<float>::infinity();
+        }
+    }
+
+    if (TIMER){
+        timers.end("query_parallel");
+    }
+    return true;
+}
+
+void HNSW::rerank(const std::vector<float>& value, std::vector<Candidate>& candidates) {
+    if (candidates.empty()) {
+        return;
+    }
+
+    if (TIMER){
+        timers.start("rerank");
+    }
+
+    std::vector<int> iids;
+    for (const auto& candidate : candidates) {
+        iids.push_back(candidate.iid);
+    }
+    std::unordered_map<int, std::vector<float>> values = fetchFullVectors(iids);
+    for (auto& candidate : candidates) {
+        auto found = values.find(candidate.iid);
+        if (found == values.end()) {
+            throw std::runtime_error("Vector of node " + std::to_string(ids.external(candidate.iid)) +
+                " is not available for reranking");
+        }
+        candidate.distance = calDistance(value, found->second);
+    }
+    std::sort(candidates.begin(), candidates.end());
+
+    if (TIMER){
+        timers.end("rerank");
+    }
+}
+
+std::unordered_map<int, std::vector<float>> HNSW::fetchFullVectors(const std::vector<int>& iids) {
+    if (isQuantized(nodes.getVectorEncoding())) {
+        return nodes.bulkGetFromDB(iids);
+    }
+    std::unordered_map<int, std::vector<float>> values;
+    std::vector<int> missing;
+    for (int iid : iids) {
+        if (nodes.has(iid)) {
+            values[iid] = nodes.get(iid).toVector();
+        } else {
+            missing.push_back(iid);
+        }
+    }
+    if (!missing.empty()) {
+        values.merge(nodes.bulkGetFromDB(missing));
+    }
+    return values;
+}
+
+void HNSW::pqEncode(int iid, const float* value) {
+    if (iid >= (int)pqEncoded.size()) {
+        int numIds = std::max(iid + 1, ids.size());
+        pqCodes.resize((size_t)numIds * pq.numSubspaces);
+        pqNormSq.resize(numIds);
+        pqEncoded.resize(numIds);
+    }
+    pqNormSq[iid] = pq.encode(value, &pqCodes[(size_t)iid * pq.numSubspaces]);
+    pqEncoded[iid] = 1;
+}
+
+void HNSW::buildProductQuantizer(int numSubspaces, int trainSize) {
+    const int numIds = ids.size();
+    if (numIds == 0) {
+        throw std::runtime_error("Index is empty");
+    }
+
+    if (TIMER){
+        timers.start("build_pq");
+    }
+
+    const int batchSize = 1024;
+    std::mt19937 sampleRng(static_cast<unsigned int>(seed));
+    std::vector<int> sample(numIds);
+    std::iota(sample.begin(), sample.end(), 0);
+    if (trainSize > 0 && trainSize < numIds) {
+        std::shuffle(sample.begin(), sample.end(), sampleRng);
+        sample.resize(trainSize);
+    }
+
+    std::vector<float> samples;
+    int numSamples = 0;
+    int dimension = 0;
+    for (size_t start = 0; start < sample.size(); start += batchSize) {
+        std::vector<int> batch(sample.begin() + start, sample.begin() + std::min(sample.size(), start + batchSize));
+        std::unordered_map<int, std::vector<float>> values = fetchFullVectors(batch);
+        for (int iid : batch) {
+            auto it = values.find(iid);
+            if (it == values.end()) {
+                continue;
+            }
+            dimension = it->second.size();
+            samples.insert(samples.end(), it->second.begin(), it->second.end());
+            ++numSamples;
+        }
+    }
+    pq.train(samples, numSamples, dimension, numSubspaces, sampleRng());
+    std::vector<float>().swap(samples);
+
+    pqCodes.assign((size_t)numIds * numSubspaces, 0);
+    pqNormSq.assign(numIds, 0.0f);
+    pqEncoded.assign(numIds, 0);
+    for (int start = 0; start < numIds; start += batchSize) {
+        std::vector<int> batch(std::min(batchSize, numIds - start));
+        std::iota(batch.begin(), batch.end(), start);
+        for (const auto& [iid, value] : fetchFullVectors(batch)) {
+            pqEncode(iid, value.data());
+        }
+    }
+    pqSearch = true;
+
+    if (TIMER){
+        timers.end("build_pq");
+    }
+}
+
+void HNSW::preparePQTable(const float* qValue) {
+    if (distanceFunction.getMetric() == EUCLIDEAN) {
+        pq.l2Table(qValue, pqTable);
+        return;
+    }
+    pq.dotTable(qValue, pqTable);
+    float normSq = 0.0f;
+    for (int d = 0; d < pq.dimension; ++d) {
+        normSq += qValue[d] * qValue[d];
+    }
+    pqQueryNorm = std::sqrt(normSq);
+}
+
+bool HNSW::signPrefiltered(int iid, float worstFound) {
+    if (!signQueryActive || !signCodes.has(iid)) {
+        return false;
+    }
+    float dotProduct = signCodes.optimisticDot(signQuery, iid, hammingMargin);
+    float estimate;
+    if (distanceFunction.getMetric() == EUCLIDEAN) {
+        float normQ = signQuery.norm, normX = signCodes.norm(iid);
+        estimate = std::sqrt(std::max(0.0f, normQ * normQ + normX * normX - 2.0f * dotProduct));
+    } else if (distanceFunction.getMetric() == COSINE) {
+        estimate = 1.0f - dotProduct / (signQuery.norm * signCodes.norm(iid));
+    } else {
+        estimate = 1.0f - dotProduct;
+    }
+    if (estimate > worstFound) {
+        ++signSkips;
+        return true;
+    }
+    return false;
+}
+
+void HNSW::buildSignCodes(int trainSize) {
+    const int numIds = ids.size();
+    if (numIds == 0) {
+        throw std::runtime_error("Index is empty");
+    }
+
+    if (TIMER){
+        timers.start("build_sign_codes");
+    }
+
+    const int batchSize = 1024;
+    std::mt19937 sampleRng(static_cast<unsigned int>(seed));
+    std::vector<int> sample(numIds);
+    std::iota(sample.begin(), sample.end(), 0);
+    if (trainSize > 0 && trainSize < numIds) {
+        std::shuffle(sample.begin(), sample.end(), sampleRng);
+        sample.resize(trainSize);
+    }
+
+    std::vector<float> samples;
+    int numSamples = 0;
+    int dimension = 0;
+    for (size_t start = 0; start < sample.size(); start += batchSize) {
+        std::vector<int> batch(sample.begin() + start, sample.begin() + std::min(sample.size(), start + batchSize));
+        for (const auto& [iid, value] : fetchFullVectors(batch)) {
+            dimension = value.size();
+            samples.insert(samples.end(), value.begin(), value.end());
+            ++numSamples;
+        }
+    }
+    signCodes.train(samples, numSamples, dimension);
+    std::vector<float>().swap(samples);
+
+    for (int start = 0; start < numIds; start += batchSize) {
+        std::vector<int> batch(std::min(batchSize, numIds - start));
+        std::iota(batch.begin(), batch.end(), start);
+        for (const auto& [iid, value] : fetchFullVectors(batch)) {
+            signCodes.encode(iid, value.data());
+        }
+    }
+    signPrefilter = true;
+
+    if (TIMER){
+        timers.end("build_sign_codes");
+    }
+}
+
+std::unordered_map<int, std::vector<float>> HNSW::prefetchMissing(const std::vector<int>& iids) {
+    std::vector<int> missing;
+    if (pqTable.empty()) { // codes are resident, nothing to fetch while scoring on them
+        for (int iid : iids) {
+            if (!nodes.has(iid)) {
+                missing.push_back(iid);
+            }
+        }
+    }
+    if (missing.empty()) {
+        return {};
+    }
+
+    if (TIMER){
+        timers.start("prefetch");
+    }
+    std::unordered_map<int, std::vector<float>> values = nodes.bulkGetFromDB(missing);
+    for (const auto& [iid, value] : values) {
+        nodes.set(iid, value); // admitted like loadFromStore would
+    }
+    if (TIMER){
+        timers.end("prefetch");
+    }
+    return values;
+}
+
+bool HNSW::scoreNode(const float* qValue, int iid, bool lazy, float& distance) {
+    if (!pqTable.empty() && iid < (int)pqEncoded.size() && pqEncoded[iid]) {
+        float sum = pq.lookup(pqTable, &pqCodes[(size_t)iid * pq.numSubspaces]);
+        if (distanceFunction.getMetric() == EUCLIDEAN) {
+            distance = std::sqrt(std::max(0.0f, sum));
+        } else if (distanceFunction.getMetric() == COSINE) {
+            distance = 1.0f - sum / (pqQueryNorm * std::sqrt(pqNormSq[iid]));
+        } else {
+            distance = 1.0f - sum;
+        }
+        return true;
+    }
+
+    VectorView value = nodes.get(iid, lazy);
+    if (value.empty()) {
+        return false;
+    }
+    distance = calDistance(qValue, value);
+    return true;
+}
+
 std::vector<Candidate> HNSW::searchLayerLazyLoading(const int qId, const std::vector<float>& qValue, 
 const std::vector<Candidate>& entryPoints, int layer, int ef) {
 
@@ -280,16 +1520,16 @@ const std::vector<Candidate>& entryPoints, int layer, int ef) {
         timers.start("search_layer");
     }
     
-    auto& graphLayer = graphLayers[layer].graph;
+    const GraphLayer& graphLayer = graphLayers[layer];
 
     std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> candidateMinHeap;
     std::priority_queue<Candidate> foundNodesMaxHeap;
-    std::unordered_set<int> visitedNodes;
+    visitedNodes.reset(ids.size());
 
     for (const auto& searchNode : entryPoints) {
         candidateMinHeap.push(searchNode);
         foundNodesMaxHeap.push(searchNode);
-        visitedNodes.insert(searchNode.iid);
+        visitedNodes.visit(searchNode.iid);
     }
 
     // for lazy loading
@@ -307,19 +1547,21 @@ const std::vector<Candidate>& entryPoints, int layer, int ef) {
                 break;
             }
 
-            const auto& curNodeDis = graphLayer.at(nearestCandidate.iid); // sorted vector<Candidate>
+            NeighborView curNodeDis = graphLayer.neighbors(nearestCandidate.iid);
 
-            for (const auto& neighbor : curNodeDis) {
-                int neighborId = neighbor.iid;
+            for (int i = 0; i < curNodeDis.size(); ++i) {
+                int neighborId = curNodeDis[i];
 
-                if (visitedNodes.find(neighborId) == visitedNodes.end()) {
-                    visitedNodes.insert(neighborId);
-                    std::vector<float> neighborValue = nodes.get(neighborId, true); // lazy loading = true
-                    if (neighborValue.size() == 0) { // lazy loading may return empty vector
+                if (!visitedNodes.visited(neighborId)) {
+                    visitedNodes.visit(neighborId);
+                    if (foundNodesMaxHeap.size() >= ef && signPrefiltered(neighborId, foundNodesMaxHeap.top().distance)) {
+                        continue; // neither fetched nor scored
+                    }
+                    float distance;
+                    if (!scoreNode(qValue.data(), neighborId, true, distance)) { // lazy loading may miss
                         lazyIdQueue.push(neighborId);
                         continue;
                     }
-                    float distance = calDistance(qValue, neighborValue);
 
                     if (foundNodesMaxHeap.size() < ef || distance < foundNodesMaxHeap.top().distance) {
                         foundNodesMaxHeap.push(Candidate(neighborId, distance));
@@ -385,7 +1627,17 @@ const std::vector<Candidate>& entryPoints, int layer, int ef) {
 void HNSW::clear() {
     nodes.clear();
     graphLayers.clear();
+    ids.clear();
+    jsonlPending.clear();
+    pq.clear();
+    pqCodes.clear();
+    pqNormSq.clear();
+    pqEncoded.clear();
+    pqSearch = false;
+    signCodes.clear();
+    signPrefilter = false;
     epId = -1;
+    distanceFunction.setDimension(0); // the next vector sets it again
     clearMonitor();
 }
 
@@ -397,9 +1649,9 @@ Candidate HNSW::searchLayerGreedy( const int qId, const std::vector<float>& qVal
         timers.start("search_layer_greedy");
     }
 
-    auto& graphLayer = graphLayers[layer].graph;
+    const GraphLayer& graphLayer = graphLayers[layer];
     
-    std::unordered_set<int> visitedNodes;
+    visitedNodes.reset(ids.size());
     std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> candidateHeap;
     candidateHeap.push(minCandidate);
 
@@ -413,18 +1665,17 @@ Candidate HNSW::searchLayerGreedy( const int qId, const std::vector<float>& qVal
             break;
         }
 
-        auto curNodeDis = graphLayer.at(curCandidate.iid); // sorted vector<Candidate>
+        NeighborView curNodeDis = graphLayer.neighbors(curCandidate.iid);
 
-        for (const auto& neighbor : curNodeDis) {
-            const int nId = neighbor.iid;
+        for (int i = 0; i < curNodeDis.size(); ++i) {
+            const int nId = curNodeDis[i];
 
-            if (visitedNodes.find(nId) == visitedNodes.end()) {
-                visitedNodes.insert(nId);
-                std::vector<float> nValue = nodes.get(nId);
-                if (nValue.size() == 0) {
+            if (!visitedNodes.visited(nId)) {
+                visitedNodes.visit(nId);
+                float distance;
+                if (!scoreNode(qValue.data(), nId, false, distance)) {
                     return Candidate();
                 }
-                float distance = calDistance(qValue, nValue);
                 if (distance < minCandidate.distance) {
                     minCandidate.iid = nId;
                     minCandidate.distance = distance;
@@ -448,20 +1699,21 @@ const std::vector<Candidate>& entryPoints, int layer, int ef) {
         timers.start("search_layer");
     }
     
-    auto& graphLayer = graphLayers[layer].graph;
+    const GraphLayer& graphLayer = graphLayers[layer];
 
     std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> candidateMinHeap;
     std::priority_queue<Candidate> foundNodesMaxHeap;
 
-    std::unordered_set<int> visitedNodes;
+    visitedNodes.reset(ids.size());
 
     for (const auto& searchNode : entryPoints) {
         candidateMinHeap.push(searchNode);
         foundNodesMaxHeap.push(searchNode);
-        visitedNodes.insert(searchNode.iid);
+        visitedNodes.visit(searchNode.iid);
     }
 
     Candidate nearestCandidate, furthestFoundNode;
+    std::vector<int> expansion; // unvisited neighbors of the node being expanded
     while (!candidateMinHeap.empty()) {
         nearestCandidate = candidateMinHeap.top();
         candidateMinHeap.pop();
@@ -471,26 +1723,40 @@ const std::vector<Candidate>& entryPoints, int layer, int ef) {
             break;
         }
 
-        const auto& curNodeDis = graphLayer.at(nearestCandidate.iid); // sorted vector<Candidate>
+        NeighborView curNodeDis = graphLayer.neighbors(nearestCandidate.iid);
 
-        for (const auto& neighbor : curNodeDis) {
-            int neighborId = neighbor.iid;
+        expansion.clear();
+        for (int i = 0; i < curNodeDis.size(); ++i) {
+            int neighborId = curNodeDis[i];
 
-            if (visitedNodes.find(neighborId) == visitedNodes.end()) {
-                visitedNodes.insert(neighborId);
-                std::vector<float> neighborValue = nodes.get(neighborId);
-                if (neighborValue.size() == 0) {
-                    return std::vector<Candidate>();
+            if (!visitedNodes.visited(neighborId)) {
+                visitedNodes.visit(neighborId);
+                if (foundNodesMaxHeap.size() >= ef && signPrefiltered(neighborId, foundNodesMaxHeap.top().distance)) {
+                    continue;
                 }
-                float distance = calDistance(qValue, neighborValue);
+                expansion.push_back(neighborId);
+            }
+        }
 
-                if (foundNodesMaxHeap.size() < ef || distance < foundNodesMaxHeap.top().distance) {
-                    foundNodesMaxHeap.push(Candidate(neighborId, distance));
-                    candidateMinHeap.push(Candidate(neighborId, distance));
+        // one bulk fetch for the uncached ones instead of a store round trip each
+        std::unordered_map<int, std::vector<float>> prefetched = prefetchMissing(expansion);
 
-                    if (foundNodesMaxHeap.size() > ef) {
-                        foundNodesMaxHeap.pop();
-                    }
+        for (int neighborId : expansion) {
+            float distance;
+            auto it = prefetched.find(neighborId);
+            if (it != prefetched.end()) {
+                distance = calDistance(qValue, it->second);
+            }
+            else if (!scoreNode(qValue.data(), neighborId, false, distance)) {
+                return std::vector<Candidate>();
+            }
+
+            if (foundNodesMaxHeap.size() < ef || distance < foundNodesMaxHeap.top().distance) {
+                foundNodesMaxHeap.push(Candidate(neighborId, distance));
+                candidateMinHeap.push(Candidate(neighborId, distance));
+
+                if (foundNodesMaxHeap.size() > ef) {
+                    foundNodesMaxHeap.pop();
                 }
             }
         }
@@ -509,6 +1775,30 @@ const std::vector<Candidate>& entryPoints, int layer, int ef) {
     return result;
 }
 
+std::vector<Candidate> HNSW::neighborCandidates(int iid, const std::vector<int>& neighborIds) {
+    std::vector<Candidate> candidates;
+
+    VectorView value = nodes.get(iid);
+    if (value.empty()) {
+        return candidates;
+    }
+    std::vector<float> decoded;
+    const float* valueFloats = floatsOf(value, decoded);
+    nodes.pin(iid); // keep value alive while the neighbors are fetched
+
+    for (int nId : neighborIds) {
+        VectorView nValue = nodes.get(nId);
+        if (nValue.empty()) {
+            nodes.unpin(iid);
+            return std::vector<Candidate>();
+        }
+        candidates.push_back(Candidate(nId, calDistance(valueFloats, nValue)));
+    }
+
+    nodes.unpin(iid);
+    return candidates;
+}
+
 std::vector<Candidate> HNSW::selectNeighborsHeuristic(
     const std::vector<Candidate>& candidates, 
     int maxSize
@@ -528,6 +1818,7 @@ std::vector<Candidate> HNSW::selectNeighborsHeuristic(
     }
 
     std::vector<Candidate> selectedNeighbors;
+    std::vector<float> decoded;
 
     Candidate candidate;
     while (!candidateMinHeap.empty()) {
@@ -540,21 +1831,31 @@ std::vector<Candidate> HNSW::selectNeighborsHeuristic(
 
         bool isCandidateFarFromExistingNeighbors = true;
 
-        for (const auto& selectedNeighbor : selectedNeighbors) {
-
-            std::vector<float> candidateValue = nodes.get(candidate.iid);
-            std::vector<float> selectedNeighborValue = nodes.get(selectedNeighbor.iid);
-            if (candidateValue.size() == 0 || selectedNeighborValue.size() == 0) {
+        if (!selectedNeighbors.empty()) {
+            VectorView candidateValue = nodes.get(candidate.iid);
+            if (candidateValue.empty()) {
                 return std::vector<Candidate>();
             }
-            float distanceCandidateToNeighbor = calDistance(
-                candidateValue, selectedNeighborValue
-            );
+            const float* candidateFloats = floatsOf(candidateValue, decoded);
+            nodes.pin(candidate.iid); // keep candidateValue alive while the neighbors are fetched
 
-            if (distanceCandidateToNeighbor < candidate.distance) {
-                isCandidateFarFromExistingNeighbors = false;
-                break;
+            for (const auto& selectedNeighbor : selectedNeighbors) {
+                VectorView selectedNeighborValue = nodes.get(selectedNeighbor.iid);
+                if (selectedNeighborValue.empty()) {
+                    nodes.unpin(candidate.iid);
+                    return std::vector<Candidate>();
+                }
+                float distanceCandidateToNeighbor = calDistance(
+                    candidateFloats, selectedNeighborValue
+                );
+
+                if (distanceCandidateToNeighbor < candidate.distance) {
+                    isCandidateFarFromExistingNeighbors = false;
+                    break;
+                }
             }
+
+            nodes.unpin(candidate.iid);
         }
 
         if (isCandidateFarFromExistingNeighbors) {
@@ -15,21 +15,62 @@
 #include <set>
 #include <unordered_set>
 #include <optional>
-#include <emscripten/val.h>
+#include <cstring>
+#include <cstdint>
+#include <string_view>
+#include <charconv>
+#include <limits>
 
 #include "json.hpp"
 #include "utils.hpp"
 #include "nodes.hpp"
+#include "idmap.hpp"
+#include "pq.hpp"
+#include "signcodes.hpp"
+
+enum MetricType { EUCLIDEAN, COSINE, COSINE_NORMALIZED };
 
 class DistanceFunctions {
 public:
+    typedef float (*Kernel)(const float* a, const float* b, int size);
+    typedef float (*RowKernel)(const float* a, const uint8_t* row, int size);
+
     std::string nameFunction;
     int distancePrecision;
+    bool rounding; // round every distance to distancePrecision, only for deterministic builds
+
+    DistanceFunctions() : DistanceFunctions("cosine-normalized", 6) {};
+    DistanceFunctions(const std::string& name, int distancePrecision)
+        : distancePrecision(distancePrecision), rounding(false), dimension(0) {
+        setFunction(name);
+        setPrecision(distancePrecision);
+    };
 
-    DistanceFunctions() : nameFunction("cosine-normalized"), distancePrecision(6) {};
-    DistanceFunctions(const std::string& name, int distancePrecision) : nameFunction(name), distancePrecision(distancePrecision) {};
+    // resolve the metric name once, so calculate() does not compare strings per call
+    void setFunction(const std::string& name);
+    MetricType getMetric() const {
+        return metric;
+    }
+    // switch to a kernel unrolled for this embedding size when one is compiled in
+    void setDimension(int _dimension);
+    int getDimension() const {
+        return dimension;
+    }
+    void setPrecision(int _distancePrecision);
 
-    float calculate(const std::vector<float>& a, const std::vector<float>& b);
+    float calculate(const std::vector<float>& a, const std::vector<float>& b) const;
+    float calculate(const float* a, const float* b, int size) const {
+        float distance = kernel(a, b, size);
+        return rounding ? round(distance) : distance;
+    }
+    // a against a cached row in whatever encoding the cache holds it
+    float calculate(const float* a, const VectorView& b) const {
+        float distance = rowKernels[static_cast<int>(b.encoding)](a, b.data, b.size);
+        return rounding ? round(distance) : distance;
+    }
+    float round(float num) const {
+        return std::round((num + 1e-16) * roundScale) / roundScale;
+    }
     float round(float num, int decimal) const;
 
     //Euclidean distance function
@@ -38,6 +79,24 @@ public:
     static float cosine(const std::vector<float>& a, const std::vector<float>& b);
     // Cosine-normalized distance function
     static float cosineNormalized(const std::vector<float>& a, const std::vector<float>& b);
+
+    // Pointer-based kernels, SIMD128 when compiled with -msimd128, scalar otherwise
+    static float euclidean(const float* a, const float* b, int size);
+    static float cosine(const float* a, const float* b, int size);
+    static float cosineNormalized(const float* a, const float* b, int size);
+
+    static float squaredL2(const float* a, const float* b, int size);
+    static float dot(const float* a, const float* b, int size);
+    static void dotAndNorms(const float* a, const float* b, int size, float& dotProduct, float& normA, float& normB);
+
+private:
+    MetricType metric;
+    int dimension;
+    Kernel kernel;
+    RowKernel rowKernels[NUM_VECTOR_ENCODINGS]; // indexed by VectorEncoding
+    double roundScale;
+
+    void selectKernel();
 };
 
 class Candidate {
@@ -56,25 +115,166 @@ public:
     }
 };
 
+// Neighbor ids of one node, either a CSR slice or a mutable overlay row
+class NeighborView {
+public:
+    const int* ids;
+    int count;
+
+    NeighborView(const int* _ids, int _count) : ids(_ids), count(_count) {}
+
+    int size() const {
+        return count;
+    }
+
+    int operator[](int i) const {
+        return ids[i];
+    }
+};
+
+// Adjacency of one HNSW layer.
+// Every node gets a dense row. freeze() packs all rows into compressed-sparse-row arrays
+// (offsets + flat neighbor ids); rows inserted or modified afterwards live in a mutable
+// overlay until the next freeze(). Only neighbor ids are stored: searches recompute
+// distances from the vectors anyway, and pruning in insert recomputes the ones it needs.
 class GraphLayer {
 public:
-    // std::unordered_map<int, std::unordered_map<int, float>> graph;
-    std::unordered_map<int, std::vector<Candidate>> graph;
+    // frozen compressed-sparse-row adjacency, iids are dense internal ids
+    std::vector<int> rowOf;             // iid -> row, -1 if the node is not in this layer
+    std::vector<int> rowIids;           // row -> iid
+    std::vector<int> offsets;           // frozen row r owns [offsets[r], offsets[r + 1])
+    std::vector<int> neighborIds;
+    int frozenRows = 0;
+
+    // mutable overlay, indexed by row
+    std::vector<std::vector<int>> overlay;
+    std::vector<bool> inOverlay;
+    int overlayRows = 0;
+
     // for streaming load jsonl
-    int curJsonlQId = -1;
+    int curJsonlRow = -1;
 
     GraphLayer() {};
     GraphLayer(int iid) {
-        graph[iid] = std::vector<Candidate>();
+        addNode(iid);
     };
 
+    int size() const {
+        return rowIids.size();
+    }
+
+    int rowOfIid(int iid) const {
+        return iid < (int)rowOf.size() ? rowOf[iid] : -1;
+    }
+
+    bool has(int iid) const {
+        return rowOfIid(iid) != -1;
+    }
+
+    int addNode(int iid) {
+        int row = rowOfIid(iid);
+        if (row != -1) {
+            return row;
+        }
+        row = rowIids.size();
+        if (iid >= (int)rowOf.size()) {
+            rowOf.resize(iid + 1, -1);
+        }
+        rowOf[iid] = row;
+        rowIids.push_back(iid);
+        thaw(row);
+        return row;
+    }
+
+    NeighborView neighborsOfRow(int row) const {
+        if (row < (int)inOverlay.size() && inOverlay[row]) {
+            return NeighborView(overlay[row].data(), overlay[row].size());
+        }
+        return NeighborView(neighborIds.data() + offsets[row], offsets[row + 1] - offsets[row]);
+    }
+
+    NeighborView neighbors(int iid) const {
+        int row = rowOfIid(iid);
+        if (row == -1) {
+            throw std::out_of_range("Node " + std::to_string(iid) + " is not in this layer");
+        }
+        return neighborsOfRow(row);
+    }
+
+    // neighbor ids, moved into the overlay so the caller can modify them
+    std::vector<int>& mutableNeighbors(int iid) {
+        int row = rowOfIid(iid);
+        if (row == -1) {
+            throw std::out_of_range("Node " + std::to_string(iid) + " is not in this layer");
+        }
+        thaw(row);
+        return overlay[row];
+    }
+
+    void setNeighbors(int iid, const std::vector<Candidate>& neighbors) {
+        int row = addNode(iid);
+        thaw(row);
+        overlay[row].clear();
+        for (const auto& neighbor : neighbors) {
+            overlay[row].push_back(neighbor.iid);
+        }
+    }
+
     void addQId(int qId) {
-        graph[qId] = std::vector<Candidate>();
-        curJsonlQId = qId;
+        curJsonlRow = addNode(qId);
+        overlay[curJsonlRow].clear();
     }
 
-    void addNeighbor(const Candidate& neighbor) {
-        graph[curJsonlQId].push_back(neighbor);
+    void addNeighbor(int nId) {
+        overlay[curJsonlRow].push_back(nId);
+    }
+
+    void freeze();
+
+    // move every row into the overlay, so later edits never resize it (the parallel build relies on that)
+    void thawAll() {
+        for (int row = 0; row < (int)rowIids.size(); ++row) {
+            thaw(row);
+        }
+    }
+
+    // adopt CSR arrays read from a binary index, rebuilding rowOf for numIds internal ids
+    void loadFrozen(int numIds) {
+        if (offsets.empty() || offsets.front() != 0 || offsets.back() != (int)neighborIds.size()) {
+            throw std::runtime_error("Corrupted layer in binary index");
+        }
+        rowOf.assign(numIds, -1);
+        for (int row = 0; row < (int)rowIids.size(); ++row) {
+            if (rowIids[row] < 0 || rowIids[row] >= numIds || offsets[row] > offsets[row + 1]) {
+                throw std::runtime_error("Corrupted layer in binary index");
+            }
+            rowOf[rowIids[row]] = row;
+        }
+        for (int nId : neighborIds) {
+            if (nId < 0 || nId >= numIds) {
+                throw std::runtime_error("Corrupted layer in binary index");
+            }
+        }
+        frozenRows = rowIids.size();
+        std::vector<std::vector<int>>().swap(overlay);
+        std::vector<bool>().swap(inOverlay);
+        overlayRows = 0;
+    }
+
+private:
+    void thaw(int row) {
+        if (row >= (int)overlay.size()) {
+            overlay.resize(row + 1);
+            inOverlay.resize(row + 1, false);
+        }
+        if (inOverlay[row]) {
+            return;
+        }
+        inOverlay[row] = true;
+        ++overlayRows;
+        if (row < frozenRows) {
+            overlay[row].assign(neighborIds.begin() + offsets[row], neighborIds.begin() + offsets[row + 1]);
+        }
     }
 };
 
@@ -82,16 +282,22 @@ class HNSW {
 private:
     float ml;
     float seed;
-    int epId;
+    int epId; // internal id
 
     DistanceFunctions distanceFunction;
     int distancePrecision;
     std::mt19937 rng;
     std::uniform_real_distribution<float> uniformDist;
 
+    VisitedList visitedNodes; // reused by every search, reset per call
+
     int getRandomLayer() {
         return static_cast<int>(std::floor(-log(uniformDist(rng)) / ml));
     }
+    // the first vector inserted or loaded fixes the dimension of the index, later ones must match it
+    void checkDimension(int dimension);
+    // queries are scored by kernels that read as many floats as the index rows have
+    void checkQueryDimension(int dimension) const;
 
     Candidate searchLayerGreedy(
         const int qId, 
@@ -110,6 +316,73 @@ private:
         const std::vector<Candidate>& candidates, 
         int maxSize
     );
+    // distances from iid to each of neighborIds, recomputed for pruning
+    std::vector<Candidate> neighborCandidates(int iid, const std::vector<int>& neighborIds);
+
+    // exact distances for the final candidates of a query scored on quantized rows or PQ codes,
+    // from one bulk fetch of their full-precision vectors
+    void rerank(const std::vector<float>& value, std::vector<Candidate>& candidates);
+    // full-precision vectors, from the cache when it holds them as floats, otherwise from the store;
+    // throws when the store is missing one of them
+    std::unordered_map<int, std::vector<float>> fetchFullVectors(const std::vector<int>& iids);
+
+    // product quantization, see buildProductQuantizer
+    ProductQuantizer pq;
+    std::vector<uint8_t> pqCodes;  // pq.numSubspaces bytes per internal id
+    std::vector<float> pqNormSq;   // squared norm of each decoded vector, for cosine
+    std::vector<uint8_t> pqEncoded;
+    bool pqSearch = false;         // query() scores on codes
+    std::vector<float> pqTable;    // table of the running query, empty outside query()
+    float pqQueryNorm = 0;
+    void pqEncode(int iid, const float* value);
+    void preparePQTable(const float* qValue);
+    // distance from qValue to iid, by table lookup while query() scores on PQ codes, otherwise
+    // from the cached vector; false if the vector is not available (lazy gets)
+    bool scoreNode(const float* qValue, int iid, bool lazy, float& distance);
+    // fetch the uncached ones of iids from the store in one call and admit them to the cache; the
+    // returned vectors are the ones fetched, the rest are scored from the cache as usual
+    std::unordered_map<int, std::vector<float>> prefetchMissing(const std::vector<int>& iids);
+
+    // sign-code prefilter, see buildSignCodes
+    SignCodes signCodes;
+    SignCodes::Query signQuery;
+    bool signPrefilter = false;  // query() skips nodes on their codes
+    bool signQueryActive = false; // signQuery holds the running query
+    float hammingMargin = 1.0f;
+    long signSkips = 0;           // nodes skipped by the prefilter since clearMonitor
+    // true when even an optimistic estimate from its sign code puts iid beyond worstFound
+    bool signPrefiltered(int iid, float worstFound);
+
+    // state shared by the workers of insertParallel and queryBatch, defined in hnsw.cpp
+    struct ParallelGraph;
+    int buildThreads = 1;
+    int queryThreads = 1;
+    // view every vector of the graph in shared.rows, loading the missing ones first; false when the
+    // cache cannot hold them all. Valid until the cache admits or evicts a row again
+    bool snapshotResidentRows(ParallelGraph& shared);
+    // counterparts of searchLayerGreedy / searchLayer / selectNeighborsHeuristic / insert for the
+    // worker threads: they score against the snapshotted rows and read or write neighbor lists
+    // only under the lock of their node, so any number of them can run at once
+    Candidate parallelSearchLayerGreedy(ParallelGraph& shared, const float* qValue, Candidate minCandidate, int layer);
+    std::vector<Candidate> parallelSearchLayer(
+        ParallelGraph& shared,
+        const int qId,
+        const float* qValue,
+        const std::vector<Candidate>& entryPoints,
+        int layer,
+        int ef,
+        VisitedList& visited
+    );
+    std::vector<Candidate> parallelSelectNeighbors(ParallelGraph& shared, const std::vector<Candidate>& candidates, int maxSize);
+    void parallelInsert(ParallelGraph& shared, const int qId, const float* qValue, int layer, VisitedList& visited);
+    // queryBatch on queryThreads threads, false (and nothing written) when the vectors are not all resident
+    bool queryParallel(const float* values, int nq, int dimension, int k, int efc, int* resultIds, float* resultDistances);
+    // re-pack layers whose overlay grew large since the last freeze (e.g. after a bulk build)
+    void freezeGrownLayers();
+
+    // trailing partial line of the last loadJsonlIndexChunk call
+    std::string jsonlPending;
+    void loadJsonlLine(std::string_view line);
 
     std::vector<Candidate> searchLayerLazyLoading(
         const int qId, 
@@ -124,8 +397,12 @@ public:
     Nodes nodes = Nodes("FIFO");
     bool lazyLoading;
     Timers timers;
+    long distanceCount = 0; // full-vector distances computed since clearMonitor, PQ lookups excluded
     std::vector<GraphLayer> graphLayers;
-    std::vector<Candidate> globalQueryResults;
+    std::vector<Candidate> globalQueryResults; // iids are external ids
+    IdMap ids; // external iid <-> dense internal id, everything below the public API uses internal ids
+    int rerankFactor = 2;
+    int pqRerankFactor = 4; // PQ codes rank coarser than sq8 rows, so their shortlist is longer
 
     HNSW(int _m = 16, int _efConstruction = 100, int _mMax = 0, float _ml = 0, float _seed = 0, int _distancePrecision = 6)
         : m(_m), efConstruction(_efConstruction), mMax(_mMax), ml(_ml), seed(_seed), distancePrecision(_distancePrecision) {
@@ -143,8 +420,12 @@ public:
         // distanceFunction = DistanceFunctions("cosine-normalized", distancePrecision);
         distanceFunction = DistanceFunctions("euclidean", distancePrecision);
         epId = -1;
+        nodes.setIdMap(&ids);
     }
 
+    HNSW(const HNSW&) = delete;
+    HNSW& operator=(const HNSW&) = delete;
+
     void clear();
     void print() const;
     std::string getJsonStrExps();
@@ -170,16 +451,99 @@ public:
         return nodes.getCacheSize();
     }
 
+    // where vectors missing from the cache are loaded from; see vectorstore.hpp
+    void setVectorStore(std::shared_ptr<VectorStore> store) {
+        nodes.setVectorStore(store);
+    }
+
+    // "float32", "sq8", "fp16" or "bf16"; the smaller rows fit more nodes into the cache. sq8 rows
+    // only rank approximately, so query reranks the final candidates with full-precision vectors
+    // from the store
+    void setVectorEncoding(const std::string& name) {
+        nodes.setVectorEncoding(name);
+    }
+
+    // candidates reranked per query when rows are quantized, as a multiple of k
+    void setRerankFactor(int _rerankFactor) {
+        rerankFactor = std::max(1, _rerankFactor);
+    }
+
+    // the same for queries scored on PQ codes; coarse codebooks (few subspaces) need more than 4
+    void setPQRerankFactor(int _pqRerankFactor) {
+        pqRerankFactor = std::max(1, _pqRerankFactor);
+    }
+
+    // train a PQ codebook over trainSize sampled nodes and encode every node, after which query()
+    // traverses on in-memory codes and only fetches vectors to rerank its shortlist
+    void buildProductQuantizer(int numSubspaces, int trainSize);
+
+    // threads insertBatch builds with, 0 for one per core; builds without pthreads use one
+    void setBuildThreads(int _buildThreads) {
+        buildThreads = std::max(0, _buildThreads);
+    }
+
+    // threads queryBatch searches on, 0 for one per core. Only used when every vector fits into the
+    // Wasm cache and neither PQ search nor the sign prefilter is on, otherwise the batch runs serially
+    void setQueryThreads(int _queryThreads) {
+        queryThreads = std::max(0, _queryThreads);
+    }
+
+    void setPQSearch(bool _pqSearch) {
+        pqSearch = _pqSearch;
+    }
+
+    // center and encode every node as one bit per dimension (trainSize sampled nodes estimate
+    // the center), after which query() skips neighbors whose code shows they cannot make the results
+    void buildSignCodes(int trainSize);
+
+    void setSignPrefilter(bool _signPrefilter) {
+        signPrefilter = _signPrefilter;
+    }
+
+    // slack of the prefilter, in standard deviations of the Hamming distance; larger skips less
+    void setHammingMargin(float _hammingMargin) {
+        hammingMargin = std::max(0.0f, _hammingMargin);
+    }
+
+    void setDistanceRounding(bool _rounding) {
+        distanceFunction.rounding = _rounding;
+    }
+
+    // pack the overlay of every layer into its CSR arrays
+    void freezeGraph();
+
     void loadIndex(const std::string& jsonIndex);
     void loadJsonlIndex(const std::string& jsonlIndex);
+    // any number of JSONL lines; a line cut at the end of a chunk is completed by the next one,
+    // last flushes it and freezes the graph
+    void loadJsonlIndexChunk(const char* chunk, size_t length, bool last=false);
     std::string exportJsonlIndex();
+    // same text as exportJsonlIndex, handed to sink in pieces of about chunkSize bytes that always end
+    // on a line break; the pointer is only valid during the sink call
+    void exportJsonlIndexChunked(const std::function<void(const char*, size_t)>& sink, size_t chunkSize=1 << 16);
+    // versioned binary index, see the layout next to the implementation; load replaces the index
+    std::string exportBinaryIndex(bool withVectors=false);
+    void loadBinaryIndex(const char* data, size_t size);
 
-    void insertSkipIndex(const int qId, const std::vector<float>& value, int layer=-1);
+    void insertSkipIndex(const int externalId, const std::vector<float>& value, int layer=-1);
 
     float calDistance(const std::vector<float>& a, const std::vector<float>& b);
+    float calDistance(const float* a, const VectorView& b);
 
-    int insert(const int qId, const std::vector<float>& value, int maxLayer=-1);
+    // size of the indexed vectors, 0 until the first one is inserted, loaded or cached
+    int getDimension() const;
+    int insert(const int externalId, const std::vector<float>& value, int maxLayer=-1);
+    // count rows of dimension floats laid out back to back, row i under externalIds[i] with a random layer;
+    // with more than one build thread the rows go through insertParallel
+    void insertBatch(const int* externalIds, const float* values, int count, int dimension);
+    // insertBatch on numThreads threads (0: one per core). Every vector of the index has to fit
+    // into the Wasm cache, the workers never call into JS. The layers drawn are the same as for
+    // insertBatch, the neighbor lists depend on the thread timing.
+    void insertParallel(const int* externalIds, const float* values, int count, int dimension, int numThreads);
     void query(const std::vector<float>& value, int k=3, int efc=-1);
+    // nq queries of dimension floats back to back; the results of query q go to ids and distances at
+    // q * k, with -1 and infinity after the last one when fewer than k are found
+    void queryBatch(const float* values, int nq, int dimension, int k, int efc, int* resultIds, float* resultDistances);
     std::vector<Candidate> getQueryResults();
 };
 
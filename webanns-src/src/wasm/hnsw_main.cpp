@@ -9,6 +9,8 @@ class HNSW_BIND : public HNSW {
 public:
     using HNSW::HNSW; // succeed the constructor of the base class
     emscripten::val resolveFinalFunc; // finish all the operations
+    std::vector<int> batchIds; // queryBatch results, reused across calls
+    std::vector<float> batchDistances;
     
     void setFinalPromise(emscripten::val resolve) {
         resolveFinalFunc = resolve;
@@ -24,10 +26,48 @@ public:
         HNSW::loadJsonlIndex(jsonStr);
     }
 
+    // chunk is either a string or a Uint8Array of UTF-8 bytes (e.g. straight from a stream reader)
+    void loadJsonlIndexChunk(const emscripten::val& chunk, bool last) {
+        if (chunk.isString()) {
+            std::string text = chunk.as<std::string>();
+            HNSW::loadJsonlIndexChunk(text.data(), text.size(), last);
+            return;
+        }
+        size_t length = chunk["length"].as<size_t>();
+        std::vector<char> buffer(length);
+        emscripten::val(emscripten::typed_memory_view(length, reinterpret_cast<uint8_t*>(buffer.data()))).call<void>("set", chunk);
+        HNSW::loadJsonlIndexChunk(buffer.data(), length, last);
+    }
+
+    void freezeGraph() {
+        HNSW::freezeGraph();
+    }
+
     emscripten::val exportJsonlIndex(){
         return emscripten::val(HNSW::exportJsonlIndex());
     }
 
+    // onChunk gets a Uint8Array view into WASM memory that is overwritten once it returns, so copy it
+    void exportJsonlIndexChunked(emscripten::val onChunk, int chunkSize) {
+        HNSW::exportJsonlIndexChunked([&onChunk](const char* chunk, size_t length) {
+            onChunk(emscripten::val(emscripten::typed_memory_view(length, reinterpret_cast<const uint8_t*>(chunk))));
+        }, chunkSize);
+    }
+
+    emscripten::val exportBinaryIndex(bool withVectors) {
+        std::string bytes = HNSW::exportBinaryIndex(withVectors);
+        emscripten::val view(emscripten::typed_memory_view(bytes.size(), reinterpret_cast<const uint8_t*>(bytes.data())));
+        return emscripten::val::global("Uint8Array").new_(view); // copy out before bytes is freed
+    }
+
+    void loadBinaryIndex(const emscripten::val& bytes) {
+        // one bulk copy of the JS bytes into WASM memory, then parse in place
+        size_t length = bytes["length"].as<size_t>();
+        std::vector<char> buffer(length);
+        emscripten::val(emscripten::typed_memory_view(length, reinterpret_cast<uint8_t*>(buffer.data()))).call<void>("set", bytes);
+        HNSW::loadBinaryIndex(buffer.data(), length);
+    }
+
     void insertSkipIndex(int qId, emscripten::val point, int layer=-1){
         std::vector<float> vec = emscripten::convertJSArrayToNumberVector<float>(point);
         HNSW::insertSkipIndex(qId, vec, layer);
@@ -46,6 +86,31 @@ public:
         resolveFinalFunc(curID);
     }
 
+    // ids holds count external ids, values count * dimension floats (both typed arrays); each is
+    // copied into WASM memory in one go and the final promise is resolved once with count
+    void insertBatch(const emscripten::val& ids, const emscripten::val& values, int dimension) {
+        if(TIMER){
+            HNSW::timers.start("insert_bind");
+        }
+        int count = ids["length"].as<int>();
+        if ((size_t)count * dimension != values["length"].as<size_t>()) {
+            throw std::invalid_argument("insertBatch expects ids.length * dimension values");
+        }
+        if (dimension <= 0 || (getDimension() > 0 && dimension != getDimension())) {
+            throw std::invalid_argument("insertBatch expects vectors of the index dimension " + std::to_string(getDimension()));
+        }
+        std::vector<int> idBuffer(count);
+        std::vector<float> valueBuffer((size_t)count * dimension);
+        emscripten::val(emscripten::typed_memory_view(idBuffer.size(), idBuffer.data())).call<void>("set", ids);
+        emscripten::val(emscripten::typed_memory_view(valueBuffer.size(), valueBuffer.data())).call<void>("set", values);
+        if(TIMER){
+            HNSW::timers.end("insert_bind");
+        }
+        HNSW::insertBatch(idBuffer.data(), valueBuffer.data(), count, dimension);
+
+        resolveFinalFunc(count);
+    }
+
     void query(emscripten::val query, int k, int ef=-1) {
 
         // if (TIMER){
@@ -64,6 +129,31 @@ public:
         resolveFinalFunc(0);
     }
 
+    // queries holds nq * getDimension() floats (a typed array), copied into WASM memory in one go; the
+    // final promise resolves with {ids, distances}, nq * k entries each as typed array views into
+    // WASM memory that stay valid until the next queryBatch or memory growth, so copy them right away
+    void queryBatch(const emscripten::val& queries, int nq, int k, int ef=-1) {
+        size_t length = queries["length"].as<size_t>();
+        const int dimension = getDimension();
+        if (nq <= 0 || dimension <= 0 || length != (size_t)nq * dimension) {
+            throw std::invalid_argument("queryBatch expects nq * " + std::to_string(dimension) + " values, the index dimension");
+        }
+        if (k <= 0) {
+            throw std::invalid_argument("queryBatch expects k > 0, the results are k slots per query");
+        }
+        std::vector<float> values(length);
+        emscripten::val(emscripten::typed_memory_view(length, values.data())).call<void>("set", queries);
+
+        batchIds.resize((size_t)nq * k);
+        batchDistances.resize((size_t)nq * k);
+        HNSW::queryBatch(values.data(), nq, dimension, k, ef, batchIds.data(), batchDistances.data());
+
+        emscripten::val results = emscripten::val::object();
+        results.set("ids", emscripten::val(emscripten::typed_memory_view(batchIds.size(), batchIds.data())));
+        results.set("distances", emscripten::val(emscripten::typed_memory_view(batchDistances.size(), batchDistances.data())));
+        resolveFinalFunc(results);
+    }
+
     void setParams(int _m, int _efConstruction, bool _lazyLoading) {
         HNSW::setParams(_m, _efConstruction, _lazyLoading);
     }
@@ -93,7 +183,11 @@ public:
     }
 
     void get_node(int index) {
-        std::vector<float> node = HNSW::nodes.get(index);
+        int iid = HNSW::ids.find(index);
+        if (iid == -1) {
+            throw std::invalid_argument("There is no node with id " + std::to_string(index) + " in the index.");
+        }
+        std::vector<float> node = HNSW::nodes.get(iid).toVector();
         resolveFinalFunc(node);
     }
 
@@ -124,6 +218,54 @@ public:
     void setItemsThreshold(int _itemsThreshold) {
         HNSW::setItemsThreshold(_itemsThreshold);
     }
+
+    void setDistanceRounding(bool rounding) {
+        HNSW::setDistanceRounding(rounding);
+    }
+
+    void setVectorEncoding(std::string encoding) {
+        HNSW::setVectorEncoding(encoding);
+    }
+
+    void setRerankFactor(int rerankFactor) {
+        HNSW::setRerankFactor(rerankFactor);
+    }
+
+    void setPQRerankFactor(int pqRerankFactor) {
+        HNSW::setPQRerankFactor(pqRerankFactor);
+    }
+
+    // may fetch vectors from JS, resolves the final promise when every node is encoded
+    void buildProductQuantizer(int numSubspaces, int trainSize) {
+        HNSW::buildProductQuantizer(numSubspaces, trainSize);
+        resolveFinalFunc(0);
+    }
+
+    void setBuildThreads(int buildThreads) {
+        HNSW::setBuildThreads(buildThreads);
+    }
+
+    void setQueryThreads(int queryThreads) {
+        HNSW::setQueryThreads(queryThreads);
+    }
+
+    void setPQSearch(bool pqSearch) {
+        HNSW::setPQSearch(pqSearch);
+    }
+
+    // may fetch vectors from JS, resolves the final promise when every node is encoded
+    void buildSignCodes(int trainSize) {
+        HNSW::buildSignCodes(trainSize);
+        resolveFinalFunc(0);
+    }
+
+    void setSignPrefilter(bool signPrefilter) {
+        HNSW::setSignPrefilter(signPrefilter);
+    }
+
+    void setHammingMargin(float hammingMargin) {
+        HNSW::setHammingMargin(hammingMargin);
+    }
 };
 
 EMSCRIPTEN_BINDINGS(hnsw_module) {
@@ -144,7 +286,12 @@ EMSCRIPTEN_BINDINGS(hnsw_module) {
         .function("setWasmMemory", &HNSW_BIND::setWasmMemory)
         .function("loadIndex", &HNSW_BIND::loadIndex)
         .function("loadJsonlIndex", &HNSW_BIND::loadJsonlIndex)
+        .function("loadJsonlIndexChunk", &HNSW_BIND::loadJsonlIndexChunk)
+        .function("freezeGraph", &HNSW_BIND::freezeGraph)
         .function("exportJsonlIndex", &HNSW_BIND::exportJsonlIndex)
+        .function("exportJsonlIndexChunked", &HNSW_BIND::exportJsonlIndexChunked)
+        .function("exportBinaryIndex", &HNSW_BIND::exportBinaryIndex)
+        .function("loadBinaryIndex", &HNSW_BIND::loadBinaryIndex)
         .function("insertSkipIndex", &HNSW_BIND::insertSkipIndex)
         .function("setParams", &HNSW_BIND::setParams)
         .function("print", &HNSW_BIND::print)
@@ -155,12 +302,25 @@ EMSCRIPTEN_BINDINGS(hnsw_module) {
         .function("get_node", &HNSW_BIND::get_node)
         .function("get_len", &HNSW_BIND::get_len)
         .function("insert", &HNSW_BIND::insert)
+        .function("insertBatch", &HNSW_BIND::insertBatch)
+        .function("setBuildThreads", &HNSW_BIND::setBuildThreads)
         .function("query", &HNSW_BIND::query)
+        .function("queryBatch", &HNSW_BIND::queryBatch)
+        .function("setQueryThreads", &HNSW_BIND::setQueryThreads)
         .function("setFinalPromise", &HNSW_BIND::setFinalPromise)
         .function("getQueryResults", &HNSW_BIND::getQueryResults)
         .function("setCacheStrategy", &HNSW_BIND::setCacheStrategy)
         .function("getCacheCounter", &HNSW_BIND::getCacheCounter)
         .function("setItemsThreshold", &HNSW_BIND::setItemsThreshold)
         .function("getItemsThreshold", &HNSW_BIND::getItemsThreshold)
-        .function("getCacheSize", &HNSW_BIND::getCacheSize);
+        .function("getCacheSize", &HNSW_BIND::getCacheSize)
+        .function("setDistanceRounding", &HNSW_BIND::setDistanceRounding)
+        .function("setVectorEncoding", &HNSW_BIND::setVectorEncoding)
+        .function("setRerankFactor", &HNSW_BIND::setRerankFactor)
+        .function("setPQRerankFactor", &HNSW_BIND::setPQRerankFactor)
+        .function("buildProductQuantizer", &HNSW_BIND::buildProductQuantizer)
+        .function("setPQSearch", &HNSW_BIND::setPQSearch)
+        .function("buildSignCodes", &HNSW_BIND::buildSignCodes)
+        .function("setSignPrefilter", &HNSW_BIND::setSignPrefilter)
+        .function("setHammingMargin", &HNSW_BIND::setHammingMargin);
 }
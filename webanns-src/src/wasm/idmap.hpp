@@ -0,0 +1,44 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+// Translation between the external iids used by JS/IndexedDB and the dense
+// 0..N-1 internal ids used by every structure inside the index.
+// Only the API boundary (insert, load, export, query results, JS fetches) hashes.
+class IdMap {
+private:
+    std::unordered_map<int, int> externalToInternal;
+    std::vector<int> internalToExternal;
+
+public:
+    int getOrAdd(int externalId) {
+        auto it = externalToInternal.find(externalId);
+        if (it != externalToInternal.end()) {
+            return it->second;
+        }
+        int internalId = internalToExternal.size();
+        externalToInternal[externalId] = internalId;
+        internalToExternal.push_back(externalId);
+        return internalId;
+    }
+
+    // -1 if the external id was never seen
+    int find(int externalId) const {
+        auto it = externalToInternal.find(externalId);
+        return it != externalToInternal.end() ? it->second : -1;
+    }
+
+    int external(int internalId) const {
+        return internalToExternal[internalId];
+    }
+
+    int size() const {
+        return internalToExternal.size();
+    }
+
+    void clear() {
+        externalToInternal.clear();
+        internalToExternal.clear();
+    }
+};
@@ -1,8 +1,5 @@
 #pragma once
 
-#include <emscripten.h>
-#include <emscripten/val.h>
-#include <emscripten/bind.h>
 #include <sstream>
 #include <iostream>        
 #include <unordered_map>   
@@ -15,10 +12,25 @@
 #include "wasmcache.hpp"
 #include "wasmcache/lru.hpp"
 #include "wasmcache/fifo.hpp"
+#include "vectorstore/memory.hpp"
+#ifdef __EMSCRIPTEN__
+#include "vectorstore/js.hpp"
+#else
+#include "vectorstore/file.hpp"
+#include "vectorstore/mmap.hpp"
+#endif
 
 class Nodes {
 private:
     std::unique_ptr<CacheStrategy> cacheStrategy;
+    const IdMap* idMap = nullptr;
+    VectorEncoding encoding = VectorEncoding::FLOAT32;
+    // the JS bridge in the browser, rows in memory until setVectorStore in native builds
+#ifdef __EMSCRIPTEN__
+    std::shared_ptr<VectorStore> vectorStore = std::make_shared<JSVectorStore>();
+#else
+    std::shared_ptr<VectorStore> vectorStore = std::make_shared<MemoryVectorStore>();
+#endif
 
 public:
     Nodes(std::string _cacheStrategy="FIFO", int _wasmMemorySize=10 * 1024 * 1024) {
@@ -31,9 +43,12 @@ public:
         else {
             throw std::invalid_argument("Invalid cache strategy");
         }
+        cacheStrategy->vectorStore = vectorStore;
     }
 
+    // the cache starts empty, rows come back from the vector store
     void setCacheStrategy(std::string _cacheStrategy) {
+        int embedSize = cacheStrategy->embedSize;
         if (_cacheStrategy == "LRU") {
             cacheStrategy = std::make_unique<LRUCache>(cacheStrategy->getWasmMemorySize());
         }
@@ -43,6 +58,34 @@ public:
         else {
             throw std::invalid_argument("Invalid cache strategy");
         }
+        cacheStrategy->idMap = idMap;
+        cacheStrategy->vectorStore = vectorStore;
+        cacheStrategy->setEncoding(encoding);
+        if (embedSize > 0) {
+            cacheStrategy->setEmbedSize(embedSize);
+        }
+    }
+
+    // rows already cached stay, the ones missing from now on come from store
+    void setVectorStore(std::shared_ptr<VectorStore> store) {
+        vectorStore = store;
+        cacheStrategy->vectorStore = vectorStore;
+    }
+
+    // "float32", "sq8", "fp16" or "bf16"; switching drops the cached rows
+    void setVectorEncoding(const std::string& name) {
+        encoding = parseVectorEncoding(name);
+        cacheStrategy->setEncoding(encoding);
+    }
+
+    VectorEncoding getVectorEncoding() const {
+        return encoding;
+    }
+
+    // iids given to Nodes are internal ids, idMap translates them for the JS side
+    void setIdMap(const IdMap* _idMap) {
+        idMap = _idMap;
+        cacheStrategy->idMap = idMap;
     }
 
     void setWasmMemorySize(int _wasmMemorySize) {
@@ -61,10 +104,33 @@ public:
         return cacheStrategy->size();
     }
 
-    std::vector<float> get(int iid, bool lazy=false) {
+    int getEmbedSize() const {
+        return cacheStrategy->embedSize;
+    }
+
+    // size the rows before the first vector is set, so the items threshold is known up front
+    void setEmbedSize(int embedSize) {
+        cacheStrategy->setEmbedSize(embedSize);
+    }
+
+    // Zero-copy access to a cached embedding. The view is invalidated by the next call that can
+    // admit a row (get of a missing iid, set, bulk admission); pin() iids whose views must outlive that.
+    VectorView get(int iid, bool lazy=false) {
         return cacheStrategy->get(iid, lazy);
     }
 
+    VectorView peek(int iid) const {
+        return cacheStrategy->peek(iid);
+    }
+
+    void pin(int iid) {
+        cacheStrategy->pin(iid);
+    }
+
+    void unpin(int iid) {
+        cacheStrategy->unpin(iid);
+    }
+
     std::unordered_map<int, std::vector<float>> bulkGetFromDB(const std::vector<int>& iids) {
         return cacheStrategy->bulkGetFromDB(iids);
     }
@@ -73,8 +139,19 @@ public:
         cacheStrategy->set(iid, value);
     }
 
+    // a vector inserted into the index: cached, and saved to the store unless the store's owner
+    // saves it itself (JS)
+    void add(int iid, const std::vector<float>& value) {
+        cacheStrategy->set(iid, value);
+        if (vectorStore->savesInserts()) {
+            cacheStrategy->saveToStore(iid, value);
+        }
+    }
+
+    // the embedding size is taken again from the next vector set
     void clear() {
         cacheStrategy->clear();
+        cacheStrategy->embedSize = 0;
     }
 
     void clearMonitor() {
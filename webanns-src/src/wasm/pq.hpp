@@ -0,0 +1,181 @@
+#pragma once
+
+#include <vector>
+#include <random>
+#include <limits>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+
+// Product quantizer: the embedding is split into numSubspaces contiguous sub-vectors and each one
+// is replaced by the id of its nearest centroid in a per-subspace codebook of up to 256 entries,
+// so a vector becomes numSubspaces bytes. Queries are scored asymmetrically: one table of
+// query-to-centroid terms per query, then one lookup per subspace per scored node.
+class ProductQuantizer {
+public:
+    static constexpr int NUM_CENTROIDS = 256;
+
+    int dimension = 0;
+    int numSubspaces = 0;
+    int subDimension = 0;
+    std::vector<float> centroids; // [subspace][centroid][subDimension]
+
+    bool trained() const {
+        return !centroids.empty();
+    }
+
+    void clear() {
+        dimension = numSubspaces = subDimension = 0;
+        centroids.clear();
+    }
+
+    // k-means per subspace over n row-major samples
+    void train(const std::vector<float>& samples, int n, int _dimension, int _numSubspaces,
+               unsigned int seed, int iterations=12) {
+        if (_numSubspaces <= 0 || _dimension % _numSubspaces != 0) {
+            throw std::invalid_argument("PQ subspaces must divide the embedding size");
+        }
+        if (n == 0) {
+            throw std::invalid_argument("PQ training needs at least one vector");
+        }
+        dimension = _dimension;
+        numSubspaces = _numSubspaces;
+        subDimension = dimension / numSubspaces;
+        centroids.assign((size_t)numSubspaces * NUM_CENTROIDS * subDimension, 0.0f);
+
+        std::mt19937 rng(seed);
+        int numCentroids = std::min(NUM_CENTROIDS, n);
+        std::vector<float> sub((size_t)n * subDimension);
+        std::vector<int> assignment(n);
+        std::vector<int> counts(numCentroids);
+        std::vector<int> order(n);
+
+        for (int m = 0; m < numSubspaces; ++m) {
+            for (int i = 0; i < n; ++i) {
+                std::copy_n(&samples[(size_t)i * dimension + m * subDimension], subDimension, &sub[(size_t)i * subDimension]);
+            }
+
+            // start from distinct random samples
+            float* codebook = &centroids[(size_t)m * NUM_CENTROIDS * subDimension];
+            std::iota(order.begin(), order.end(), 0);
+            std::shuffle(order.begin(), order.end(), rng);
+            for (int c = 0; c < numCentroids; ++c) {
+                std::copy_n(&sub[(size_t)order[c] * subDimension], subDimension, codebook + (size_t)c * subDimension);
+            }
+
+            for (int iter = 0; iter < iterations; ++iter) {
+                for (int i = 0; i < n; ++i) {
+                    assignment[i] = nearest(codebook, numCentroids, &sub[(size_t)i * subDimension]);
+                }
+
+                std::fill(codebook, codebook + (size_t)numCentroids * subDimension, 0.0f);
+                std::fill(counts.begin(), counts.end(), 0);
+                for (int i = 0; i < n; ++i) {
+                    float* centroid = codebook + (size_t)assignment[i] * subDimension;
+                    for (int d = 0; d < subDimension; ++d) {
+                        centroid[d] += sub[(size_t)i * subDimension + d];
+                    }
+                    ++counts[assignment[i]];
+                }
+                for (int c = 0; c < numCentroids; ++c) {
+                    float* centroid = codebook + (size_t)c * subDimension;
+                    if (counts[c] == 0) { // empty cluster, restart it on a random sample
+                        std::copy_n(&sub[(size_t)(rng() % n) * subDimension], subDimension, centroid);
+                        continue;
+                    }
+                    for (int d = 0; d < subDimension; ++d) {
+                        centroid[d] /= counts[c];
+                    }
+                }
+            }
+        }
+        // unused centroids (fewer samples than NUM_CENTROIDS) repeat the first one
+        for (int m = 0; m < numSubspaces; ++m) {
+            float* codebook = &centroids[(size_t)m * NUM_CENTROIDS * subDimension];
+            for (int c = numCentroids; c < NUM_CENTROIDS; ++c) {
+                std::copy_n(codebook, subDimension, codebook + (size_t)c * subDimension);
+            }
+        }
+    }
+
+    // writes numSubspaces codes, returns the squared norm of the decoded vector
+    float encode(const float* value, uint8_t* code) const {
+        float normSq = 0.0f;
+        for (int m = 0; m < numSubspaces; ++m) {
+            const float* codebook = &centroids[(size_t)m * NUM_CENTROIDS * subDimension];
+            int c = nearest(codebook, NUM_CENTROIDS, value + m * subDimension);
+            code[m] = static_cast<uint8_t>(c);
+            for (int d = 0; d < subDimension; ++d) {
+                float x = codebook[(size_t)c * subDimension + d];
+                normSq += x * x;
+            }
+        }
+        return normSq;
+    }
+
+    // table[m][c] = |q_m - centroid_mc|^2, summed over a code this is the squared L2 distance
+    void l2Table(const float* query, std::vector<float>& table) const {
+        table.resize((size_t)numSubspaces * NUM_CENTROIDS);
+        for (int m = 0; m < numSubspaces; ++m) {
+            const float* q = query + m * subDimension;
+            const float* codebook = &centroids[(size_t)m * NUM_CENTROIDS * subDimension];
+            for (int c = 0; c < NUM_CENTROIDS; ++c) {
+                table[m * NUM_CENTROIDS + c] = squaredL2(q, codebook + (size_t)c * subDimension);
+            }
+        }
+    }
+
+    // table[m][c] = q_m . centroid_mc, summed over a code this is the dot product
+    void dotTable(const float* query, std::vector<float>& table) const {
+        table.resize((size_t)numSubspaces * NUM_CENTROIDS);
+        for (int m = 0; m < numSubspaces; ++m) {
+            const float* q = query + m * subDimension;
+            const float* codebook = &centroids[(size_t)m * NUM_CENTROIDS * subDimension];
+            for (int c = 0; c < NUM_CENTROIDS; ++c) {
+                const float* centroid = codebook + (size_t)c * subDimension;
+                float dotProduct = 0.0f;
+                for (int d = 0; d < subDimension; ++d) {
+                    dotProduct += q[d] * centroid[d];
+                }
+                table[m * NUM_CENTROIDS + c] = dotProduct;
+            }
+        }
+    }
+
+    float lookup(const std::vector<float>& table, const uint8_t* code) const {
+        float s0 = 0.0f, s1 = 0.0f;
+        int m = 0;
+        for (; m + 2 <= numSubspaces; m += 2) {
+            s0 += table[m * NUM_CENTROIDS + code[m]];
+            s1 += table[(m + 1) * NUM_CENTROIDS + code[m + 1]];
+        }
+        if (m < numSubspaces) {
+            s0 += table[m * NUM_CENTROIDS + code[m]];
+        }
+        return s0 + s1;
+    }
+
+private:
+    float squaredL2(const float* a, const float* b) const {
+        float sum = 0.0f;
+        for (int d = 0; d < subDimension; ++d) {
+            float diff = a[d] - b[d];
+            sum += diff * diff;
+        }
+        return sum;
+    }
+
+    int nearest(const float* codebook, int numCentroids, const float* value) const {
+        int best = 0;
+        float bestDistance = std::numeric_limits<float>::max();
+        for (int c = 0; c < numCentroids; ++c) {
+            float distance = squaredL2(value, codebook + (size_t)c * subDimension);
+            if (distance < bestDistance) {
+                bestDistance = distance;
+                best = c;
+            }
+        }
+        return best;
+    }
+};
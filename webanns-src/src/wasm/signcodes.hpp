@@ -0,0 +1,131 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+
+// One bit per dimension and node: whether the vector lies above the corpus mean in that dimension.
+// The Hamming distance between two codes estimates the angle between the centered vectors, and
+// together with the two norms kept next to each code that gives a rough estimate of the dot
+// product, so any of our metrics, for 1/32 of the memory of a float32 row. The codes are always
+// resident and serve as a prefilter: nodes that clearly cannot make the result list are skipped
+// before their vector is fetched or scored.
+class SignCodes {
+public:
+    int dimension = 0;
+    int words = 0;
+    std::vector<float> center;
+
+    // per-query state, see prepare()
+    struct Query {
+        std::vector<uint64_t> code;
+        float centeredNorm = 0;
+        float norm = 0;
+    };
+
+    bool trained() const {
+        return !center.empty();
+    }
+
+    bool has(int iid) const {
+        return iid < (int)encoded.size() && encoded[iid];
+    }
+
+    void clear() {
+        dimension = words = 0;
+        center.clear();
+        codes.clear();
+        centeredNorms.clear();
+        norms.clear();
+        encoded.clear();
+    }
+
+    size_t allocatedBytes() const {
+        return codes.size() * sizeof(uint64_t) + (centeredNorms.size() + norms.size()) * sizeof(float) + encoded.size();
+    }
+
+    // the per-dimension mean of n row-major samples becomes the center, existing codes are dropped
+    void train(const std::vector<float>& samples, int n, int _dimension) {
+        if (n == 0) {
+            throw std::invalid_argument("Sign codes need at least one vector");
+        }
+        dimension = _dimension;
+        words = (dimension + 63) / 64;
+        center.assign(dimension, 0.0f);
+        for (int i = 0; i < n; ++i) {
+            for (int d = 0; d < dimension; ++d) {
+                center[d] += samples[(size_t)i * dimension + d];
+            }
+        }
+        for (float& c : center) {
+            c /= n;
+        }
+        codes.clear();
+        centeredNorms.clear();
+        norms.clear();
+        encoded.clear();
+    }
+
+    void encode(int iid, const float* value) {
+        if (iid >= (int)encoded.size()) {
+            codes.resize((size_t)(iid + 1) * words, 0);
+            centeredNorms.resize(iid + 1, 0.0f);
+            norms.resize(iid + 1, 0.0f);
+            encoded.resize(iid + 1, 0);
+        }
+        centeredNorms[iid] = encodeBits(value, &codes[(size_t)iid * words], norms[iid]);
+        encoded[iid] = 1;
+    }
+
+    void prepare(const float* value, Query& query) const {
+        query.code.assign(words, 0);
+        query.centeredNorm = encodeBits(value, query.code.data(), query.norm);
+    }
+
+    // optimistic estimate of q . x: the Hamming distance is lowered by margin standard deviations
+    // of its worst case (sqrt(dimension) / 2) before it is turned into an angle, so a node is
+    // only judged far when its code disagrees with the query by a wide margin
+    float optimisticDot(const Query& query, int iid, float margin) const {
+        const uint64_t* code = &codes[(size_t)iid * words];
+        int hamming = 0;
+        for (int w = 0; w < words; ++w) {
+            hamming += __builtin_popcountll(query.code[w] ^ code[w]);
+        }
+        float lowered = std::max(0.0f, hamming - margin * 0.5f * std::sqrt((float)dimension));
+        float cosAngle = std::cos(static_cast<float>(M_PI) * lowered / dimension);
+
+        // |q - x|^2 from the centered norms and angle, then q . x = (|q|^2 + |x|^2 - |q - x|^2) / 2
+        float rq = query.centeredNorm, rx = centeredNorms[iid];
+        float distanceSq = std::max(0.0f, rq * rq + rx * rx - 2.0f * rq * rx * cosAngle);
+        return 0.5f * (query.norm * query.norm + norms[iid] * norms[iid] - distanceSq);
+    }
+
+    float norm(int iid) const {
+        return norms[iid];
+    }
+
+private:
+    std::vector<uint64_t> codes;      // words per internal id
+    std::vector<float> centeredNorms; // |x - center|
+    std::vector<float> norms;         // |x|
+    std::vector<uint8_t> encoded;
+
+    // writes the bits of value, returns |value - center| and sets norm to |value|
+    float encodeBits(const float* value, uint64_t* bits, float& norm) const {
+        float centeredSq = 0.0f, normSq = 0.0f;
+        for (int d = 0; d < dimension; ++d) {
+            float centered = value[d] - center[d];
+            if (centered > 0.0f) {
+                bits[d / 64] |= uint64_t(1) << (d % 64);
+            } else {
+                bits[d / 64] &= ~(uint64_t(1) << (d % 64));
+            }
+            centeredSq += centered * centered;
+            normSq += value[d] * value[d];
+        }
+        norm = std::sqrt(normSq);
+        return std::sqrt(centeredSq);
+    }
+};
@@ -5,9 +5,12 @@
 #include <unordered_map>
 #include <queue>
 #include <unordered_set>
+#include <vector>
+#include <cstdint>
 
 #define TIMER true
 #define CACHECOUNTER true
+#define DISTANCECOUNTER true
 
 class Timer {
 public:
@@ -125,56 +128,44 @@ public:
 
 class CacheCounter {
 public:
-    std::unordered_map<int, int> hitCounter;
-    std::unordered_map<int, int> missCounter;
+    int hitCount;
+    int missCount;
     CacheCounter() {
-        hitCounter.clear();
-        missCounter.clear();
+        hitCount = 0;
+        missCount = 0;
     }
 
     void hit(int iid) {
-        if (hitCounter.find(iid) == hitCounter.end()) {
-            hitCounter[iid] = 1;
-        } else {
-            ++hitCounter[iid];
-        }
+        ++hitCount;
     }
 
     void miss(int iid) {
-        if (missCounter.find(iid) == missCounter.end()) {
-            missCounter[iid] = 1;
-        } else {
-            ++missCounter[iid];
-        }
-    }
-
-    int getSum(const std::unordered_map<int, int>& counter) const {
-        return std::accumulate(counter.begin(), counter.end(), 0, [](int sum, const std::pair<int, int>& p) { return sum + p.second; });
+        ++missCount;
     }
 
     void print() const {
-        std::cout << "Wasm::hitCounter.total: " << getSum(hitCounter) << std::endl;
-        std::cout << "Wasm::missCounter.total: " << getSum(missCounter) << std::endl;
+        std::cout << "Wasm::hitCounter.total: " << hitCount << std::endl;
+        std::cout << "Wasm::missCounter.total: " << missCount << std::endl;
     }   
 
     nlohmann::json toJson() const {
         nlohmann::json jsonCounter;
-        jsonCounter["hit"] = getSum(hitCounter);
-        jsonCounter["miss"] = getSum(missCounter);
+        jsonCounter["hit"] = hitCount;
+        jsonCounter["miss"] = missCount;
         return jsonCounter;
     }
 
     std::string getCounterStr() const {
         std::string counterStr = "";
-        counterStr += std::to_string(getSum(hitCounter));
+        counterStr += std::to_string(hitCount);
         counterStr += ",";
-        counterStr += std::to_string(getSum(missCounter));
+        counterStr += std::to_string(missCount);
         return counterStr;
     }
 
     void clear() {
-        hitCounter.clear();
-        missCounter.clear();
+        hitCount = 0;
+        missCount = 0;
     }
 };
 
@@ -182,12 +173,17 @@ class CacheCounters {
 public:
     std::unordered_map<std::string, CacheCounter> cacheCounters;
     std::string mode;
+    CacheCounter* current; // counter of the current mode, map nodes never move
 
     CacheCounters() {
         cacheCounters.clear();
         mode = "default";
+        current = &cacheCounters[mode];
     }
 
+    CacheCounters(const CacheCounters&) = delete;
+    CacheCounters& operator=(const CacheCounters&) = delete;
+
     void setMode(const std::string& _mode) {
         if (!_mode.empty()) {
             mode = _mode;
@@ -195,26 +191,20 @@ public:
         else {
             mode = "default";
         }
+        current = &cacheCounters[mode];
     }
 
     void hit(int iid) {
-        auto it = cacheCounters.find(mode);
-        if (it == cacheCounters.end()) {
-            cacheCounters[mode] = CacheCounter();
-        }
-        cacheCounters[mode].hit(iid);
+        current->hit(iid);
     }
 
     void miss(int iid) {
-        auto it = cacheCounters.find(mode);
-        if (it == cacheCounters.end()) {
-            cacheCounters[mode] = CacheCounter();
-        }
-        cacheCounters[mode].miss(iid);
+        current->miss(iid);
     }
 
     void clear() {
         cacheCounters.clear();
+        current = &cacheCounters[mode];
     }
 
     void print() const {
@@ -233,12 +223,41 @@ public:
     }
 
     std::string getCounterStr() {
-        return cacheCounters[mode].getCounterStr();
+        return current->getCounterStr();
     }
 
 
 };
 
+// Visited marks for one search, indexed by internal id.
+// reset() starts a new search in O(1) by bumping the epoch; the array is only
+// cleared when the 16-bit epoch wraps around.
+class VisitedList {
+private:
+    std::vector<uint16_t> marks;
+    uint16_t epoch = 0;
+
+public:
+    void reset(int numIds) {
+        if ((int)marks.size() < numIds) {
+            marks.resize(numIds, 0);
+        }
+        ++epoch;
+        if (epoch == 0) {
+            std::fill(marks.begin(), marks.end(), 0);
+            epoch = 1;
+        }
+    }
+
+    bool visited(int iid) const {
+        return marks[iid] == epoch;
+    }
+
+    void visit(int iid) {
+        marks[iid] = epoch;
+    }
+};
+
 class UniqueQueue {
 private:
     std::queue<int> itemQueue;
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include "vectorcodec.hpp"
+
+// Non-owning view of one embedding row, in the encoding the cache stores it in.
+// A view returned by the cache stays valid until the next call that may admit a row into the
+// cache (a missing get, set, bulk admission or a threshold change), because admission can evict
+// and reuse the row. Pin the iid (CacheStrategy::pin) to keep its row across such calls.
+struct VectorView {
+    const uint8_t* data;
+    int size; // dimensions, not bytes
+    VectorEncoding encoding;
+
+    VectorView() : data(nullptr), size(0), encoding(VectorEncoding::FLOAT32) {}
+    VectorView(const uint8_t* _data, int _size, VectorEncoding _encoding=VectorEncoding::FLOAT32)
+        : data(_data), size(_size), encoding(_encoding) {}
+
+    bool empty() const {
+        return data == nullptr;
+    }
+
+    // the floats of a FLOAT32 row
+    const float* floats() const {
+        return reinterpret_cast<const float*>(data);
+    }
+
+    std::vector<float> toVector() const {
+        std::vector<float> value(data == nullptr ? 0 : size);
+        if (data != nullptr) {
+            decodeRow(encoding, data, size, value.data());
+        }
+        return value;
+    }
+};
+
+// Slot-based storage for cached embeddings.
+// Rows live in fixed-size blocks of one 64-byte aligned buffer each, so a row never
+// moves once allocated and every row starts on a cache line (rowStride is padded to 64 bytes).
+// Blocks are added on demand, which keeps a large maxWasmMemory from being committed up front.
+class VectorArena {
+private:
+    static constexpr int ROWS_PER_BLOCK = 256;
+    static constexpr int ROW_ALIGN_BYTES = 64;
+
+    struct AlignedFree {
+        void operator()(uint8_t* ptr) const { std::free(ptr); }
+    };
+
+    std::vector<std::unique_ptr<uint8_t[], AlignedFree>> blocks;
+    std::vector<int> iidToSlot; // dense, indexed by iid, -1 if not resident
+    std::vector<int> slotToIid; // -1 for free slots
+    std::vector<int> pinCount;  // per slot, pinned rows are never evicted
+    std::vector<int> freeSlots;
+    int numRows;
+
+public:
+    int rowSize;   // dimensions per row
+    int rowStride; // bytes per row, encoded size padded to ROW_ALIGN_BYTES
+    VectorEncoding encoding;
+
+    VectorArena() : numRows(0), rowSize(0), rowStride(0), encoding(VectorEncoding::FLOAT32) {}
+
+    void init(int _rowSize, VectorEncoding _encoding=VectorEncoding::FLOAT32) {
+        blocks.clear();
+        iidToSlot.clear();
+        slotToIid.clear();
+        pinCount.clear();
+        freeSlots.clear();
+        numRows = 0;
+        rowSize = _rowSize;
+        encoding = _encoding;
+        size_t rowBytes = encodedRowBytes(encoding, rowSize);
+        rowStride = (rowBytes + ROW_ALIGN_BYTES - 1) / ROW_ALIGN_BYTES * ROW_ALIGN_BYTES;
+    }
+
+    int slotOf(int iid) const {
+        return iid >= 0 && iid < (int)iidToSlot.size() ? iidToSlot[iid] : -1;
+    }
+
+    bool has(int iid) const {
+        return slotOf(iid) != -1;
+    }
+
+    uint8_t* row(int slot) {
+        return blocks[slot / ROWS_PER_BLOCK].get() + (size_t)(slot % ROWS_PER_BLOCK) * rowStride;
+    }
+
+    const uint8_t* row(int slot) const {
+        return blocks[slot / ROWS_PER_BLOCK].get() + (size_t)(slot % ROWS_PER_BLOCK) * rowStride;
+    }
+
+    // returns the slot of iid, allocating one (reusing evicted slots first) if needed
+    int allocate(int iid) {
+        int slot = slotOf(iid);
+        if (slot != -1) {
+            return slot;
+        }
+
+        if (!freeSlots.empty()) {
+            slot = freeSlots.back();
+            freeSlots.pop_back();
+        } else {
+            slot = slotToIid.size();
+            if (slot % ROWS_PER_BLOCK == 0) {
+                size_t blockBytes = (size_t)ROWS_PER_BLOCK * rowStride;
+                uint8_t* block = static_cast<uint8_t*>(std::aligned_alloc(ROW_ALIGN_BYTES, blockBytes));
+                if (block == nullptr) {
+                    throw std::bad_alloc();
+                }
+                blocks.emplace_back(block);
+            }
+            slotToIid.push_back(-1);
+            pinCount.push_back(0);
+        }
+
+        if (iid >= (int)iidToSlot.size()) {
+            iidToSlot.resize(iid + 1, -1);
+        }
+        iidToSlot[iid] = slot;
+        slotToIid[slot] = iid;
+        ++numRows;
+        return slot;
+    }
+
+    void release(int iid) {
+        int slot = slotOf(iid);
+        if (slot == -1) {
+            return;
+        }
+        iidToSlot[iid] = -1;
+        slotToIid[slot] = -1;
+        freeSlots.push_back(slot);
+        --numRows;
+    }
+
+    VectorView view(int iid) const {
+        int slot = slotOf(iid);
+        return slot == -1 ? VectorView() : VectorView(row(slot), rowSize, encoding);
+    }
+
+    void pin(int iid) {
+        int slot = slotOf(iid);
+        if (slot != -1) {
+            ++pinCount[slot];
+        }
+    }
+
+    void unpin(int iid) {
+        int slot = slotOf(iid);
+        if (slot != -1 && pinCount[slot] > 0) {
+            --pinCount[slot];
+        }
+    }
+
+    bool pinned(int iid) const {
+        int slot = slotOf(iid);
+        return slot != -1 && pinCount[slot] > 0;
+    }
+
+    // keeps the allocated blocks so a refill does not hit malloc again
+    void clear() {
+        iidToSlot.clear();
+        freeSlots.clear();
+        for (int slot = slotToIid.size() - 1; slot >= 0; --slot) {
+            slotToIid[slot] = -1;
+            pinCount[slot] = 0;
+            freeSlots.push_back(slot);
+        }
+        numRows = 0;
+    }
+
+    int size() const {
+        return numRows;
+    }
+
+    size_t allocatedBytes() const {
+        return blocks.size() * (size_t)ROWS_PER_BLOCK * rowStride;
+    }
+};
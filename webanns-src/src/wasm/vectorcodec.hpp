@@ -0,0 +1,194 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+
+// How the cache stores an embedding row.
+//   FLOAT32: the embedding as is.
+//   SQ8:     SQ8Header followed by one uint8 code per dimension, x[d] ~= lo + step * code[d].
+//            Scale and offset are per vector, so rows can be encoded as they stream in without
+//            a training pass. Distances are computed asymmetrically (float query x codes).
+//   FP16:    IEEE half precision, 2 bytes per dimension.
+//   BF16:    bfloat16 (the upper half of a float32), 2 bytes per dimension, float32 range.
+// The half-precision encodings are also what JS stores, so their rows move between JS and
+// the cache without conversion; see jsEncoding().
+enum class VectorEncoding : uint8_t { FLOAT32, SQ8, FP16, BF16 };
+static constexpr int NUM_VECTOR_ENCODINGS = 4;
+
+struct SQ8Header {
+    float lo;
+    float step;
+    float normSq; // squared norm of the decoded vector, for euclidean and cosine
+    float reserved;
+};
+
+inline VectorEncoding parseVectorEncoding(const std::string& name) {
+    if (name == "float32") {
+        return VectorEncoding::FLOAT32;
+    } else if (name == "sq8") {
+        return VectorEncoding::SQ8;
+    } else if (name == "fp16") {
+        return VectorEncoding::FP16;
+    } else if (name == "bf16") {
+        return VectorEncoding::BF16;
+    }
+    throw std::invalid_argument("Unknown vector encoding " + name);
+}
+
+inline std::string vectorEncodingName(VectorEncoding encoding) {
+    switch (encoding) {
+        case VectorEncoding::SQ8: return "sq8";
+        case VectorEncoding::FP16: return "fp16";
+        case VectorEncoding::BF16: return "bf16";
+        default: return "float32";
+    }
+}
+
+// rows lose information against what JS stores, so results need a full-precision rerank
+inline bool isQuantized(VectorEncoding encoding) {
+    return encoding == VectorEncoding::SQ8;
+}
+
+// the encoding JS keeps the vectors of a cache with this encoding in
+inline VectorEncoding jsEncoding(VectorEncoding encoding) {
+    return encoding == VectorEncoding::FP16 || encoding == VectorEncoding::BF16 ? encoding : VectorEncoding::FLOAT32;
+}
+
+inline uint32_t floatBits(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+inline float bitsFloat(uint32_t bits) {
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// round to nearest even; NaN stays NaN
+inline uint16_t floatToBf16(float value) {
+    uint32_t bits = floatBits(value);
+    if ((bits & 0x7fffffff) > 0x7f800000) {
+        return static_cast<uint16_t>((bits >> 16) | 0x40);
+    }
+    return static_cast<uint16_t>((bits + 0x7fff + ((bits >> 16) & 1)) >> 16);
+}
+
+inline float bf16ToFloat(uint16_t value) {
+    return bitsFloat(static_cast<uint32_t>(value) << 16);
+}
+
+// round half away from zero, overflow saturates to infinity (same rule as the JS side)
+inline uint16_t floatToHalf(float value) {
+    uint32_t bits = floatBits(value);
+    uint16_t sign = static_cast<uint16_t>((bits >> 16) & 0x8000);
+    int exponent = static_cast<int>((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    if (((bits >> 23) & 0xff) == 0xff) { // inf or NaN
+        return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+    }
+    if (exponent <= 0) { // subnormal half or zero
+        if (exponent < -10) {
+            return sign;
+        }
+        mantissa = (mantissa | 0x800000) >> (1 - exponent);
+        return sign | static_cast<uint16_t>((mantissa + 0x1000) >> 13);
+    }
+    mantissa += 0x1000;
+    if (mantissa & 0x800000) { // rounding carried into the exponent
+        mantissa = 0;
+        ++exponent;
+    }
+    if (exponent >= 0x1f) {
+        return sign | 0x7c00;
+    }
+    return sign | static_cast<uint16_t>(exponent << 10) | static_cast<uint16_t>(mantissa >> 13);
+}
+
+// the magnitude bits moved into float position and rescaled by 2^(127-15); inf and NaN (exponent
+// 0x1f) would rescale to finite values, so their exponent is saturated instead
+inline float halfToFloat(uint16_t value) {
+    if ((value & 0x7c00) == 0x7c00) {
+        return bitsFloat((static_cast<uint32_t>(value & 0x8000) << 16) | 0x7f800000 | (static_cast<uint32_t>(value & 0x3ff) << 13));
+    }
+    float magnitude = bitsFloat(static_cast<uint32_t>(value & 0x7fff) << 13) * 0x1p112f;
+    return bitsFloat(floatBits(magnitude) | (static_cast<uint32_t>(value & 0x8000) << 16));
+}
+
+// bytes one encoded row of size floats takes, before the arena pads it
+inline size_t encodedRowBytes(VectorEncoding encoding, int size) {
+    switch (encoding) {
+        case VectorEncoding::SQ8: return sizeof(SQ8Header) + size;
+        case VectorEncoding::FP16:
+        case VectorEncoding::BF16: return size * sizeof(uint16_t);
+        default: return size * sizeof(float);
+    }
+}
+
+inline void encodeSQ8(const float* value, int size, uint8_t* row) {
+    SQ8Header* header = reinterpret_cast<SQ8Header*>(row);
+    uint8_t* codes = row + sizeof(SQ8Header);
+
+    auto [minIt, maxIt] = std::minmax_element(value, value + size);
+    float lo = size > 0 ? *minIt : 0.0f;
+    float step = size > 0 ? (*maxIt - lo) / 255.0f : 0.0f;
+    float invStep = step > 0.0f ? 1.0f / step : 0.0f;
+
+    float normSq = 0.0f;
+    for (int i = 0; i < size; ++i) {
+        float code = std::min(255.0f, std::round((value[i] - lo) * invStep));
+        codes[i] = static_cast<uint8_t>(code);
+        float decoded = lo + step * code;
+        normSq += decoded * decoded;
+    }
+    *header = SQ8Header{lo, step, normSq, 0.0f};
+}
+
+inline void decodeSQ8(const uint8_t* row, int size, float* value) {
+    const SQ8Header* header = reinterpret_cast<const SQ8Header*>(row);
+    const uint8_t* codes = row + sizeof(SQ8Header);
+    for (int i = 0; i < size; ++i) {
+        value[i] = header->lo + header->step * codes[i];
+    }
+}
+
+inline void encodeRow(VectorEncoding encoding, const float* value, int size, uint8_t* row) {
+    switch (encoding) {
+        case VectorEncoding::SQ8: encodeSQ8(value, size, row); break;
+        case VectorEncoding::FP16:
+            for (int i = 0; i < size; ++i) {
+                uint16_t half = floatToHalf(value[i]);
+                std::memcpy(row + i * sizeof(uint16_t), &half, sizeof(uint16_t));
+            }
+            break;
+        case VectorEncoding::BF16:
+            for (int i = 0; i < size; ++i) {
+                uint16_t half = floatToBf16(value[i]);
+                std::memcpy(row + i * sizeof(uint16_t), &half, sizeof(uint16_t));
+            }
+            break;
+        default: std::memcpy(row, value, size * sizeof(float)); break;
+    }
+}
+
+inline void decodeRow(VectorEncoding encoding, const uint8_t* row, int size, float* value) {
+    switch (encoding) {
+        case VectorEncoding::SQ8: decodeSQ8(row, size, value); break;
+        case VectorEncoding::FP16:
+        case VectorEncoding::BF16:
+            for (int i = 0; i < size; ++i) {
+                uint16_t half;
+                std::memcpy(&half, row + i * sizeof(uint16_t), sizeof(uint16_t));
+                value[i] = encoding == VectorEncoding::FP16 ? halfToFloat(half) : bf16ToFloat(half);
+            }
+            break;
+        default: std::memcpy(value, row, size * sizeof(float)); break;
+    }
+}
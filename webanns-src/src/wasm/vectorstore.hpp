@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include "vectorcodec.hpp"
+
+// Where the cache gets the vectors it does not hold. Ids are external ids; rows are size elements
+// in the encoding asked for, which is jsEncoding() of the cache encoding (float32, fp16 or bf16).
+//   JSVectorStore:     the JS cache and IndexedDB behind the GWRAG bridge, Emscripten builds only
+//   MemoryVectorStore: rows in a hash map, what native builds start with
+//   FileVectorStore:   a flat file of fixed-size rows, native builds only
+//   MappedVectorStore: the same file mapped into memory, for collections larger than RAM
+class VectorStore {
+public:
+    virtual ~VectorStore() = default;
+
+    // write the row of id into row; false if the store does not have it. May suspend on a promise
+    virtual bool load(int id, uint8_t* row, int size, VectorEncoding encoding) = 0;
+
+    // load, but only from where the store answers without waiting; false otherwise, lazy searches
+    // skip such nodes and fetch them in bulk later
+    virtual bool loadCached(int id, uint8_t* row, int size, VectorEncoding encoding) {
+        return load(id, row, size, encoding);
+    }
+
+    // the rows of ids back to back, loadedIds[i] is the id of row i (the order may differ from ids);
+    // false if any of them is missing
+    virtual bool bulkLoad(const std::vector<int>& ids, int* loadedIds, uint8_t* rows, int size, VectorEncoding encoding) {
+        size_t rowBytes = encodedRowBytes(encoding, size);
+        for (size_t i = 0; i < ids.size(); ++i) {
+            loadedIds[i] = ids[i];
+            if (!load(ids[i], rows + i * rowBytes, size, encoding)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // keep rows (back to back) under ids
+    virtual void save(const std::vector<int>& ids, const uint8_t* rows, int size, VectorEncoding encoding) = 0;
+
+    // whether vectors inserted into the index have to be saved here; JS stores them itself before
+    // it inserts them
+    virtual bool savesInserts() const {
+        return true;
+    }
+};
+
+// copy a row of size elements from one encoding into another
+inline void convertRow(VectorEncoding from, const uint8_t* in, VectorEncoding to, uint8_t* out, int size) {
+    if (from == to) {
+        std::memcpy(out, in, encodedRowBytes(from, size));
+        return;
+    }
+    std::vector<float> value(size);
+    decodeRow(from, in, size, value.data());
+    encodeRow(to, value.data(), size, out);
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include <cstdio>
+#include <string>
+#include <stdexcept>
+#include <algorithm>
+#include "../vectorstore.hpp"
+
+// A flat file of rows, the row of id at id * rowBytes, e.g. the float32 embeddings of a dataset
+// dumped back to back. Every row below the end of the file counts as present; saving past the end
+// grows the file. Rows are converted when another encoding is asked for.
+class FileVectorStore : public VectorStore {
+private:
+    std::FILE* file = nullptr;
+    int dimension;
+    VectorEncoding encoding;
+    size_t rowBytes;
+    long long numRows = 0;
+    std::vector<uint8_t> buffer; // a row in the file encoding, when it needs converting
+
+public:
+    // create truncates the file, otherwise it has to exist
+    FileVectorStore(const std::string& path, int _dimension, VectorEncoding _encoding=VectorEncoding::FLOAT32, bool create=false)
+        : dimension(_dimension), encoding(_encoding), rowBytes(encodedRowBytes(_encoding, _dimension)) {
+        if (isQuantized(encoding)) {
+            throw std::invalid_argument("Vector files hold float32, fp16 or bf16 rows");
+        }
+        file = std::fopen(path.c_str(), create ? "w+b" : "r+b");
+        if (file == nullptr) {
+            throw std::runtime_error("Cannot open vector file " + path);
+        }
+        std::fseek(file, 0, SEEK_END);
+        numRows = std::ftell(file) / (long long)rowBytes;
+        buffer.resize(rowBytes);
+    }
+
+    FileVectorStore(const FileVectorStore&) = delete;
+    FileVectorStore& operator=(const FileVectorStore&) = delete;
+
+    ~FileVectorStore() override {
+        std::fclose(file);
+    }
+
+    bool load(int id, uint8_t* row, int size, VectorEncoding rowEncoding) override {
+        if (size != dimension) {
+            throw std::invalid_argument("Vector file has " + std::to_string(dimension) + " dimensions, not " + std::to_string(size));
+        }
+        if (id < 0 || id >= numRows) {
+            return false;
+        }
+        uint8_t* target = rowEncoding == encoding ? row : buffer.data();
+        std::fseek(file, (long)(id * (long long)rowBytes), SEEK_SET);
+        if (std::fread(target, 1, rowBytes, file) != rowBytes) {
+            return false;
+        }
+        if (target != row) {
+            convertRow(encoding, target, rowEncoding, row, size);
+        }
+        return true;
+    }
+
+    void save(const std::vector<int>& ids, const uint8_t* rows, int size, VectorEncoding rowEncoding) override {
+        if (size != dimension) {
+            throw std::invalid_argument("Vector file has " + std::to_string(dimension) + " dimensions, not " + std::to_string(size));
+        }
+        size_t inBytes = encodedRowBytes(rowEncoding, size);
+        for (size_t i = 0; i < ids.size(); ++i) {
+            const uint8_t* source = rows + i * inBytes;
+            if (rowEncoding != encoding) {
+                convertRow(rowEncoding, source, encoding, buffer.data(), size);
+                source = buffer.data();
+            }
+            std::fseek(file, (long)(ids[i] * (long long)rowBytes), SEEK_SET);
+            if (std::fwrite(source, 1, rowBytes, file) != rowBytes) {
+                throw std::runtime_error("Cannot write to vector file");
+            }
+            numRows = std::max(numRows, (long long)ids[i] + 1);
+        }
+        std::fflush(file);
+    }
+
+    long long size() const {
+        return numRows;
+    }
+};
@@ -0,0 +1,49 @@
+#pragma once
+#include <emscripten/val.h>
+#include "../vectorstore.hpp"
+
+// The JS cache and IndexedDB, through the functions of GWRAG.wragInstance (see wrag.ts). JS writes
+// the rows straight to the pointers it is given.
+class JSVectorStore : public VectorStore {
+public:
+    bool load(int id, uint8_t* row, int size, VectorEncoding encoding) override {
+        // suspends until the returned promise settles (Asyncify, or JSPI when built with -sJSPI)
+        return bridge().call<emscripten::val>("loadJ2W",
+            id, reinterpret_cast<uintptr_t>(row), size, static_cast<int>(encoding)
+        ).await().as<int>() == 1;
+    }
+
+    // the JS cache only, without touching IndexedDB
+    bool loadCached(int id, uint8_t* row, int size, VectorEncoding encoding) override {
+        return bridge().call<emscripten::val>("loadJ2W_nodb",
+            id, reinterpret_cast<uintptr_t>(row), size, static_cast<int>(encoding)
+        ).as<int>() != 0;
+    }
+
+    bool bulkLoad(const std::vector<int>& ids, int* loadedIds, uint8_t* rows, int size, VectorEncoding encoding) override {
+        // suspends until the returned promise settles, the search resumes exactly once
+        return bridge().call<emscripten::val>("bulkGetFromDB",
+            emscripten::val::array(ids),
+            reinterpret_cast<uintptr_t>(loadedIds),
+            reinterpret_cast<uintptr_t>(rows),
+            size,
+            static_cast<int>(encoding)
+        ).await().as<int>() == 1;
+    }
+
+    // into the JS cache, valuesLength still counts elements
+    void save(const std::vector<int>& ids, const uint8_t* rows, int size, VectorEncoding encoding) override {
+        bridge().call<emscripten::val>("saveW2J",
+            reinterpret_cast<uintptr_t>(ids.data()), ids.size(),
+            reinterpret_cast<uintptr_t>(rows), ids.size() * size, size, static_cast<int>(encoding));
+    }
+
+    bool savesInserts() const override {
+        return false;
+    }
+
+private:
+    static emscripten::val bridge() {
+        return emscripten::val::global("GWRAG")["wragInstance"];
+    }
+};
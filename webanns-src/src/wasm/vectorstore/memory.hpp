@@ -0,0 +1,38 @@
+#pragma once
+#include <unordered_map>
+#include "../vectorstore.hpp"
+
+// Every row in memory, kept in the encoding it was saved in.
+class MemoryVectorStore : public VectorStore {
+private:
+    struct Row {
+        VectorEncoding encoding;
+        std::vector<uint8_t> bytes;
+    };
+    std::unordered_map<int, Row> stored;
+
+public:
+    bool load(int id, uint8_t* row, int size, VectorEncoding encoding) override {
+        auto it = stored.find(id);
+        if (it == stored.end()) {
+            return false;
+        }
+        convertRow(it->second.encoding, it->second.bytes.data(), encoding, row, size);
+        return true;
+    }
+
+    void save(const std::vector<int>& ids, const uint8_t* rows, int size, VectorEncoding encoding) override {
+        size_t rowBytes = encodedRowBytes(encoding, size);
+        for (size_t i = 0; i < ids.size(); ++i) {
+            stored[ids[i]] = Row{encoding, std::vector<uint8_t>(rows + i * rowBytes, rows + (i + 1) * rowBytes)};
+        }
+    }
+
+    size_t size() const {
+        return stored.size();
+    }
+
+    void clear() {
+        stored.clear();
+    }
+};
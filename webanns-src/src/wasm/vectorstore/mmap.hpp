@@ -0,0 +1,147 @@
+#pragma once
+#include <string>
+#include <stdexcept>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "../vectorstore.hpp"
+
+// The flat row file of FileVectorStore, mapped into memory instead of read with stdio. Rows are
+// read straight from the mapping and the kernel pages them in and out, so the file can be far larger
+// than RAM; the Wasm cache on top keeps the hot rows decoded. POSIX only.
+class MappedVectorStore : public VectorStore {
+private:
+    int fd = -1;
+    uint8_t* mapped = nullptr;
+    size_t mappedBytes = 0;
+    int dimension;
+    VectorEncoding encoding;
+    size_t rowBytes;
+    long long numRows = 0;
+    bool writable;
+
+    void map(size_t bytes) {
+        if (mapped != nullptr) {
+            munmap(mapped, mappedBytes);
+            mapped = nullptr;
+        }
+        mappedBytes = bytes;
+        numRows = bytes / rowBytes;
+        if (bytes == 0) { // mmap refuses empty ranges, nothing to read anyway
+            return;
+        }
+        int protection = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+        void* address = mmap(nullptr, bytes, protection, MAP_SHARED, fd, 0);
+        if (address == MAP_FAILED) {
+            throw std::runtime_error("Cannot map vector file");
+        }
+        mapped = static_cast<uint8_t*>(address);
+        // searches jump between unrelated rows, read-ahead would only evict hot pages
+        madvise(mapped, mappedBytes, MADV_RANDOM);
+    }
+
+    const uint8_t* rowOf(int id) const {
+        return mapped + (size_t)id * rowBytes;
+    }
+
+    void checkSize(int size) const {
+        if (size != dimension) {
+            throw std::invalid_argument("Vector file has " + std::to_string(dimension) + " dimensions, not " + std::to_string(size));
+        }
+    }
+
+public:
+    // create truncates the file, otherwise it has to exist; a read-only store rejects save
+    MappedVectorStore(const std::string& path, int _dimension, VectorEncoding _encoding=VectorEncoding::FLOAT32,
+                      bool create=false, bool _writable=true)
+        : dimension(_dimension), encoding(_encoding), rowBytes(encodedRowBytes(_encoding, _dimension)),
+          writable(_writable || create) {
+        if (isQuantized(encoding)) {
+            throw std::invalid_argument("Vector files hold float32, fp16 or bf16 rows");
+        }
+        int flags = writable ? O_RDWR : O_RDONLY;
+        if (create) {
+            flags |= O_CREAT | O_TRUNC;
+        }
+        fd = open(path.c_str(), flags, 0644);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open vector file " + path);
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            close(fd);
+            throw std::runtime_error("Cannot stat vector file " + path);
+        }
+        map((size_t)info.st_size / rowBytes * rowBytes);
+    }
+
+    MappedVectorStore(const MappedVectorStore&) = delete;
+    MappedVectorStore& operator=(const MappedVectorStore&) = delete;
+
+    ~MappedVectorStore() override {
+        if (mapped != nullptr) {
+            munmap(mapped, mappedBytes);
+        }
+        close(fd);
+    }
+
+    bool load(int id, uint8_t* row, int size, VectorEncoding rowEncoding) override {
+        checkSize(size);
+        if (id < 0 || id >= numRows) {
+            return false;
+        }
+        convertRow(encoding, rowOf(id), rowEncoding, row, size);
+        return true;
+    }
+
+    // ask the kernel for the pages of every row first, so the misses are read in parallel instead
+    // of one page fault at a time while copying
+    bool bulkLoad(const std::vector<int>& ids, int* loadedIds, uint8_t* rows, int size, VectorEncoding rowEncoding) override {
+        checkSize(size);
+        size_t pageBytes = (size_t)sysconf(_SC_PAGESIZE);
+        for (int id : ids) {
+            if (id < 0 || id >= numRows) {
+                return false;
+            }
+            uintptr_t begin = reinterpret_cast<uintptr_t>(rowOf(id)) & ~(uintptr_t)(pageBytes - 1);
+            uintptr_t end = reinterpret_cast<uintptr_t>(rowOf(id)) + rowBytes;
+            madvise(reinterpret_cast<void*>(begin), end - begin, MADV_WILLNEED);
+        }
+        size_t outBytes = encodedRowBytes(rowEncoding, size);
+        for (size_t i = 0; i < ids.size(); ++i) {
+            loadedIds[i] = ids[i];
+            convertRow(encoding, rowOf(ids[i]), rowEncoding, rows + i * outBytes, size);
+        }
+        return true;
+    }
+
+    // rows inside the file are written through the mapping; saving past the end grows the file and
+    // maps it again, so write large files up front rather than row by row
+    void save(const std::vector<int>& ids, const uint8_t* rows, int size, VectorEncoding rowEncoding) override {
+        checkSize(size);
+        if (!writable) {
+            throw std::runtime_error("Vector file is mapped read-only");
+        }
+        int maxId = -1;
+        for (int id : ids) {
+            maxId = std::max(maxId, id);
+        }
+        if (maxId >= numRows) {
+            size_t bytes = ((size_t)maxId + 1) * rowBytes;
+            if (ftruncate(fd, (off_t)bytes) != 0) {
+                throw std::runtime_error("Cannot grow vector file");
+            }
+            map(bytes);
+        }
+        size_t inBytes = encodedRowBytes(rowEncoding, size);
+        for (size_t i = 0; i < ids.size(); ++i) {
+            convertRow(rowEncoding, rows + i * inBytes, encoding, mapped + (size_t)ids[i] * rowBytes, size);
+        }
+    }
+
+    long long size() const {
+        return numRows;
+    }
+};
@@ -1,8 +1,5 @@
 #pragma once
 
-#include <emscripten.h>
-#include <emscripten/val.h>
-#include <emscripten/bind.h>
 #include <sstream>
 #include <iostream>        
 #include <unordered_map>   
@@ -10,12 +7,16 @@
 #include <list>
 #include <cmath>
 #include <optional>
-#include <atomic>
+#include <stdexcept>
 #include "utils.hpp"
+#include "vectorarena.hpp"
+#include "idmap.hpp"
+#include "vectorstore.hpp"
 
 class CacheStrategy {
 public:
-    std::unordered_map<int, std::vector<float>> wasmCache;
+    VectorArena arena;
+    VectorEncoding encoding = VectorEncoding::FLOAT32;
     int maxWasmMemory;
     int embedSize;
     int maxWasmItems;
@@ -25,15 +26,20 @@ public:
     Timers timers;
     CacheCounters cacheCounter;
 
+    // cache keys are internal ids, JS only knows the external ones
+    const IdMap* idMap = nullptr;
+    // where rows missing from the cache come from, set by Nodes
+    std::shared_ptr<VectorStore> vectorStore;
+
     CacheStrategy(int _wasmMemorySize) : maxWasmMemory(_wasmMemorySize) {
         embedSize = 0;
         maxWasmItems = 0;
         itemsThreshold = 0;
-        wasmCache.clear();
         strategy = "undefined";
     }
     virtual ~CacheStrategy() = default; 
-    virtual std::vector<float> get(int iid, bool lazy=false) = 0;
+    // The returned view points into the arena, see VectorView for its lifetime rule
+    virtual VectorView get(int iid, bool lazy=false) = 0;
     virtual void set(int iid, const std::vector<float>& value) = 0; 
     virtual void clear() = 0;
     virtual void deleteSome() = 0;
@@ -42,9 +48,11 @@ public:
         std::cout << "Wasm::strategy: " << strategy << std::endl;
         std::cout << "Wasm::maxWasmMemory: " << maxWasmMemory << std::endl;
         std::cout << "Wasm::embedSize: " << embedSize << std::endl;
+        std::cout << "Wasm::encoding: " << vectorEncodingName(encoding) << std::endl;
         std::cout << "Wasm::maxWasmItems: " << maxWasmItems << std::endl;
         std::cout << "Wasm::itemsThreshold: " << itemsThreshold << std::endl;
-        std::cout << "Wasm::wasmCache.size(): " << wasmCache.size() << std::endl;
+        std::cout << "Wasm::wasmCache.size(): " << arena.size() << std::endl;
+        std::cout << "Wasm::arena.allocatedBytes(): " << arena.allocatedBytes() << std::endl;
 
         // print timers
         timers.print();
@@ -60,9 +68,11 @@ public:
         jsonCache["strategy"] = strategy;
         jsonCache["maxWasmMemory"] = maxWasmMemory;
         jsonCache["embedSize"] = embedSize;
+        jsonCache["encoding"] = vectorEncodingName(encoding);
         jsonCache["maxWasmItems"] = maxWasmItems;
         jsonCache["itemsThreshold"] = itemsThreshold;
-        jsonCache["wasmCacheSize"] = wasmCache.size();
+        jsonCache["wasmCacheSize"] = arena.size();
+        jsonCache["arenaBytes"] = arena.allocatedBytes();
         jsonCache["timers"] = timers.toJson();
         if(CACHECOUNTER){
             jsonCache["cacheCounter"] = cacheCounter.toJson();
@@ -71,29 +81,59 @@ public:
     }
 
     int size() const {
-        return wasmCache.size();
+        return arena.size();
     }
 
     int has(int iid) const {
-        return wasmCache.find(iid) != wasmCache.end() ? 1 : 0;
+        return arena.has(iid) ? 1 : 0;
+    }
+
+    // the cached row of iid without loading it or touching the eviction order and counters,
+    // empty when it is not cached
+    VectorView peek(int iid) const {
+        return arena.view(iid);
+    }
+
+    void pin(int iid) {
+        arena.pin(iid);
+    }
+
+    void unpin(int iid) {
+        arena.unpin(iid);
     }
 
     void setWasmMemorySize(int _wasmMemorySize) {
         maxWasmMemory = _wasmMemorySize;
         if(embedSize > 0){
-            maxWasmItems = maxWasmMemory / (embedSize * sizeof(float));
+            maxWasmItems = maxWasmMemory / arena.rowStride;
             itemsThreshold = std::floor(maxWasmItems);
         }
     }
 
     void setEmbedSize(int _embedSize) {
         embedSize = _embedSize;
+        arena.init(embedSize, encoding);
+        if (jsEncoding(encoding) != encoding) {
+            loadBuffer.resize(embedSize);
+        }
         if(maxWasmMemory > 0){
-            maxWasmItems = maxWasmMemory / (embedSize * sizeof(float));
+            maxWasmItems = maxWasmMemory / arena.rowStride;
             itemsThreshold = std::floor(maxWasmItems);
         }
     }
 
+    // drops every cached row, the rows are re-fetched from the store in the new encoding
+    void setEncoding(VectorEncoding _encoding) {
+        if (_encoding == encoding) {
+            return;
+        }
+        clear();
+        encoding = _encoding;
+        if (embedSize > 0) {
+            setEmbedSize(embedSize);
+        }
+    }
+
     void setItemsThreshold(int _itemsThreshold) {
         itemsThreshold = _itemsThreshold;
         deleteSome();
@@ -115,24 +155,25 @@ public:
         if (DEBUG)
             std::cout << "wasm::wasmcache::bulkGetFromDB (iids size=" << _iids.size() << ")" << std::endl;
 
+        // the store hands the rows over in the encoding it keeps them in
         int numIids = _iids.size();
-        std::vector<float> memPointer(numIids * embedSize);
+        VectorEncoding stored = jsEncoding(encoding);
+        size_t rowBytes = encodedRowBytes(stored, embedSize);
+        std::vector<uint8_t> memPointer(numIids * rowBytes);
         std::vector<int> iidsPointer(numIids);
-        std::atomic<int> gottenFlag{0};
-
-        emscripten::val::global("GWRAG")["wragInstance"].call<emscripten::val>("bulkGetFromDB",
-            emscripten::val::array(_iids),
-            reinterpret_cast<uintptr_t>(iidsPointer.data()),
-            reinterpret_cast<uintptr_t>(memPointer.data()),
-            embedSize,
-            reinterpret_cast<uintptr_t>(&gottenFlag)
-        );
 
-        while (gottenFlag == 0) {
-            emscripten_sleep(0);
+        std::vector<int> externalIids(numIids);
+        for (int i = 0; i < numIids; ++i) {
+            externalIids[i] = toExternal(_iids[i]);
         }
+
+        bool loaded = vectorStore->bulkLoad(externalIids, iidsPointer.data(), memPointer.data(), embedSize, stored);
+
         if (DEBUG)
-            std::cout << "wasm::wasmcache::bulkGetFromDB: gottenFlag=" << gottenFlag << std::endl;
+            std::cout << "wasm::wasmcache::bulkGetFromDB: loaded=" << loaded << std::endl;
+        if (!loaded) {
+            throw std::runtime_error("Some vectors are not available in the vector store");
+        }
     
         if(DEBUG){
             std::cout << "wasm::wasmcache::bulkGetFromDB: iidsPointer.size()=" << iidsPointer.size() << std::endl;
@@ -144,7 +185,8 @@ public:
 
         std::unordered_map<int, std::vector<float>> loadResults;
         for (int i = 0; i < numIids; ++i) {
-            std::vector<float> value(memPointer.begin() + i * embedSize, memPointer.begin() + (i + 1) * embedSize);
+            std::vector<float> value(embedSize);
+            decodeRow(stored, memPointer.data() + i * rowBytes, embedSize, value.data());
             if(DEBUG){
                 std::cout << "wasm::wasmcache::bulkGetFromDB: " << iidsPointer[i] << " ";
                 for (int j = 0; j < std::min(5, (int)value.size()); j++) {
@@ -152,7 +194,7 @@ public:
                 }
                 std::cout << std::endl;
             }
-            loadResults[iidsPointer[i]] = value;
+            loadResults[toInternal(iidsPointer[i])] = value;
         }
 
         if (DEBUG)
@@ -161,89 +203,122 @@ public:
         return loadResults;
     }
 
+    // hand value to the store as the row of iid, encoded the way the store keeps it
+    void saveToStore(int iid, const std::vector<float>& value) {
+        checkSize(value);
+        VectorEncoding stored = jsEncoding(encoding);
+        std::vector<uint8_t> row(encodedRowBytes(stored, embedSize));
+        encodeRow(stored, value.data(), embedSize, row.data());
+        vectorStore->save({toExternal(iid)}, row.data(), embedSize, stored);
+    }
+
 protected:
-    std::vector<float> loadFromJS(int iid) {
-        if (DEBUG)
-            std::cout << "wasm::loadFromJS (iid=" << iid << ") (size=" << embedSize << ")" << std::endl;
+    std::vector<float> loadBuffer; // the store writes float32 rows here when the cache re-encodes them
 
-        float* memPointer = new float[embedSize];
-        int gottenFlag = 0;
-        
-        emscripten::val::global("GWRAG")["wragInstance"].call<emscripten::val>("loadJ2W",\
-            iid, reinterpret_cast<uintptr_t>(memPointer), embedSize, reinterpret_cast<uintptr_t>(&gottenFlag));
-            // .call<void>("then", emscripten::val::module_property("gottenIndexedDB"));
-        
-        while (gottenFlag == 0) {
-            emscripten_sleep(0);
+    int toExternal(int iid) const {
+        return idMap != nullptr ? idMap->external(iid) : iid;
+    }
+
+    int toInternal(int externalId) const {
+        return idMap != nullptr ? idMap->find(externalId) : externalId;
+    }
+
+    // rows are embedSize floats wide, a shorter or longer value would be read or written past its end
+    void checkSize(const std::vector<float>& value) const {
+        if ((int)value.size() != embedSize) {
+            throw std::invalid_argument("Vector has " + std::to_string(value.size()) + " dimensions, the cache holds " +
+                std::to_string(embedSize));
         }
+    }
 
-        if (DEBUG)
-            std::cout << "wasm::loadFromJS: gottenFlag=" << gottenFlag << std::endl;
-        assert(gottenFlag == 1);
+    // encode value into the arena row of iid, allocating the row if needed
+    void store(int iid, const std::vector<float>& value) {
+        checkSize(value);
+        int slot = arena.allocate(iid);
+        encodeRow(encoding, value.data(), embedSize, arena.row(slot));
+    }
 
-        std::vector<float> value(memPointer, memPointer + embedSize);
-        delete[] memPointer;
-    
-        if (DEBUG) {
-            std::cout << "wasm::loadFromJS: " << iid << " ";
-            for (int i = 0; i < std::min(5, (int)value.size()); i++) {
-                std::cout << value[i] << " ";
-            }
-            std::cout << std::endl;
+    // where the store should write the row of iid: the arena row itself when it keeps vectors in
+    // the cache encoding (float32, fp16, bf16), otherwise loadBuffer to be encoded by finishLoad
+    uint8_t* loadTarget(int slot) {
+        if (jsEncoding(encoding) == encoding) {
+            return arena.row(slot);
         }
+        return reinterpret_cast<uint8_t*>(loadBuffer.data());
+    }
 
-        return value;
+    void finishLoad(int slot) {
+        if (jsEncoding(encoding) != encoding) {
+            encodeRow(encoding, loadBuffer.data(), embedSize, arena.row(slot));
+        }
     }
 
-    std::vector<float> loadOnlyFromJS(int iid) {
+    // evict down to itemsThreshold right after admitting iid, without evicting iid itself
+    VectorView admitted(int iid) {
+        arena.pin(iid);
+        deleteSome();
+        arena.unpin(iid);
+        return arena.view(iid);
+    }
 
+    // fetch iid from the store straight into its arena row
+    void loadFromStore(int iid) {
         if (DEBUG)
-            std::cout << "wasm::loadOnlyFromJS (iid=" << iid << ") (size=" << embedSize << ")" << std::endl;
+            std::cout << "wasm::loadFromStore (iid=" << iid << ") (size=" << embedSize << ")" << std::endl;
 
-        float* memPointer = new float[embedSize];
+        int slot = arena.allocate(iid);
+        uint8_t* memPointer = loadTarget(slot);
         
-        emscripten::val loadResult = emscripten::val::global("GWRAG")["wragInstance"].call<emscripten::val>("loadJ2W_nodb",\
-            iid, reinterpret_cast<uintptr_t>(memPointer), embedSize);
-        int gottenFlag = loadResult.as<int>();
+        bool loaded = vectorStore->load(toExternal(iid), memPointer, embedSize, jsEncoding(encoding));
 
         if (DEBUG)
-            std::cout << "wasm::loadOnlyFromJS: gottenFlag=" << gottenFlag << std::endl;
-
-        if (gottenFlag == 0) {
-            delete[] memPointer;
-            return std::vector<float>();
+            std::cout << "wasm::loadFromStore: loaded=" << loaded << std::endl;
+        if (!loaded) {
+            arena.release(iid);
+            throw std::runtime_error("Vector of node " + std::to_string(toExternal(iid)) + " is not available in the vector store");
         }
-
-        std::vector<float> value(memPointer, memPointer + embedSize);
-        delete[] memPointer;
-        
+        finishLoad(slot);
+    
         if (DEBUG) {
-            std::cout << "wasm::loadOnlyFromJS: " << iid << " ";
-            for (int i = 0; i < std::min(5, (int)value.size()); i++) {
-                std::cout << value[i] << " ";
+            std::cout << "wasm::loadFromStore: " << iid << " ";
+            std::vector<float> loaded = arena.view(iid).toVector();
+            for (int i = 0; i < std::min(5, embedSize); i++) {
+                std::cout << loaded[i] << " ";
             }
             std::cout << std::endl;
         }
-
-        return value;
     }
 
-    void saveToJS(const std::vector<int>& iids, const std::vector<std::vector<float>>& values) {
+    // fetch iid only if the store has it at hand (the JS cache, not IndexedDB); false otherwise
+    bool loadCachedFromStore(int iid) {
+
         if (DEBUG)
-            std::cout << "wasm::saveToJS" << std::endl;
+            std::cout << "wasm::loadCachedFromStore (iid=" << iid << ") (size=" << embedSize << ")" << std::endl;
+
+        int slot = arena.allocate(iid);
+        uint8_t* memPointer = loadTarget(slot);
+        
+        bool gotten = vectorStore->loadCached(toExternal(iid), memPointer, embedSize, jsEncoding(encoding));
 
-        uintptr_t iidsPointer = reinterpret_cast<uintptr_t>(iids.data());
-        size_t iidsLength = iids.size();
+        if (DEBUG)
+            std::cout << "wasm::loadCachedFromStore: gotten=" << gotten << std::endl;
 
-        std::vector<float> flattened;
-        for (const auto& value : values) {
-            flattened.insert(flattened.end(), value.begin(), value.end());
+        if (!gotten) {
+            arena.release(iid);
+            return false;
+        }
+        finishLoad(slot);
+        
+        if (DEBUG) {
+            std::cout << "wasm::loadCachedFromStore: " << iid << " ";
+            std::vector<float> loaded = arena.view(iid).toVector();
+            for (int i = 0; i < std::min(5, embedSize); i++) {
+                std::cout << loaded[i] << " ";
+            }
+            std::cout << std::endl;
         }
-        uintptr_t valuesPointer = reinterpret_cast<uintptr_t>(flattened.data());
-        size_t valuesLength = flattened.size();
 
-        emscripten::val saveFunc = emscripten::val::global("GWRAG")["wragInstance"].call<emscripten::val>("saveW2J", \
-            iidsPointer, iidsLength, valuesPointer, valuesLength, embedSize);        
+        return true;
     }
 };
 
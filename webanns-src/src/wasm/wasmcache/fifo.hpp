@@ -13,63 +13,64 @@ public:
     }
 
     void deleteSome() override{
-        while (wasmCache.size() > itemsThreshold) {
+        int skipped = 0;
+        while (arena.size() > itemsThreshold && skipped < (int)fifoList.size()) {
             int iidToEvict = fifoList.front();
-            wasmCache.erase(iidToEvict);
             fifoList.pop_front();
+            if (arena.pinned(iidToEvict)) { // still referenced by a view, keep it for now
+                fifoList.push_back(iidToEvict);
+                ++skipped;
+                continue;
+            }
+            arena.release(iidToEvict); // the slot is reused by the next admission
         }
     }
 
-    std::vector<float> get(int iid, bool lazy=false) override {
+    VectorView get(int iid, bool lazy=false) override {
         int hasFlag = has(iid);
         if (hasFlag == 0) { // not in wasmCache
-            std::vector<float> value;
             if (lazy) {
-                value = loadOnlyFromJS(iid);
-                if (value.size() == 0) {
+                if (!loadCachedFromStore(iid)) {
                     // neither hit or miss, just ignore and wait for the lazy loading
-                    return value; // if lazy ==true, may return empty vector
+                    return VectorView(); // if lazy ==true, may return empty vector
                 }
                 if(CACHECOUNTER){
                     cacheCounter.hit(iid);
                 }
             } else {
-                value = loadFromJS(iid); // if lazy == false, must return a valid vector
+                loadFromStore(iid); // if lazy == false, must return a valid vector
                 if(CACHECOUNTER){
                    cacheCounter.miss(iid);
                 }
             }
-            wasmCache[iid] = value;
             fifoList.push_back(iid);
-            deleteSome();
+            return admitted(iid);
         } else if (hasFlag == 1) { // get from wasmCache
             if(CACHECOUNTER){
                 cacheCounter.hit(iid);
             }
         }
 
-        return wasmCache.at(iid);
+        return arena.view(iid);
     }
 
     void set(int iid, const std::vector<float>& value) override {
         if (embedSize == 0) { // initialization
-            embedSize = value.size();
-            maxWasmItems = maxWasmMemory / (embedSize * sizeof(float));
-            itemsThreshold = std::floor(maxWasmItems);
+            setEmbedSize(value.size());
         }
 
         int hasFlag = has(iid);
         if (hasFlag == 1) { // update
-            wasmCache[iid] = value;
+            store(iid, value);
         } else if (hasFlag == 0) { // directly insert
-            wasmCache[iid] = value;
+            store(iid, value);
             fifoList.push_back(iid);
             deleteSome();
         }
     }
 
     void clear() override {
-        wasmCache.clear();
+        arena.clear();
         fifoList.clear();
     }
 
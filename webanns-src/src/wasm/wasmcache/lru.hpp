@@ -13,36 +13,39 @@ public:
     }
 
     void deleteSome() override {
-        while (wasmCache.size() > itemsThreshold) {
+        int skipped = 0;
+        while (arena.size() > itemsThreshold && skipped < (int)lruList.size()) {
             int iidToEvict = lruList.back();
-            wasmCache.erase(iidToEvict);
+            if (arena.pinned(iidToEvict)) { // still referenced by a view, treat it as recently used
+                lruList.splice(lruList.begin(), lruList, lruMap[iidToEvict]);
+                ++skipped;
+                continue;
+            }
+            arena.release(iidToEvict); // the slot is reused by the next admission
             lruMap.erase(iidToEvict);
             lruList.pop_back();
         }
     }
     
-    std::vector<float> get(int iid, bool lazy=false) override {
+    VectorView get(int iid, bool lazy=false) override {
         int hasFlag = has(iid);
         if (hasFlag == 0) { // not in wasmCache
-            std::vector<float> value;
             if (lazy) {
-                value = loadOnlyFromJS(iid);
-                if (value.size() == 0) {
-                    return value;
+                if (!loadCachedFromStore(iid)) {
+                    return VectorView();
                 }
                 if(CACHECOUNTER){
                    cacheCounter.hit(iid);
                 }
             } else {
-                value = loadFromJS(iid);
+                loadFromStore(iid);
                 if(CACHECOUNTER){
                    cacheCounter.miss(iid);
                 }
             }
-            wasmCache[iid] = value;
             lruList.push_front(iid);
             lruMap[iid] = lruList.begin();
-            deleteSome();
+            return admitted(iid);
         } else if (hasFlag == 1) { // get from wasmCache
             if(CACHECOUNTER){
                 cacheCounter.hit(iid);
@@ -50,22 +53,21 @@ public:
             lruList.splice(lruList.begin(), lruList, lruMap[iid]); // move to the front
         }
 
-        return wasmCache.at(iid);
+        return arena.view(iid);
     }
 
     void set(int iid, const std::vector<float>& value) override {
         if (embedSize == 0) { // initialization
-            embedSize = value.size();
-            maxWasmItems = maxWasmMemory / (embedSize * sizeof(float));
+            setEmbedSize(value.size());
             itemsThreshold = std::floor(maxWasmItems * 0.8);
         }
 
         int hasFlag = has(iid);
         if (hasFlag == 1) { // update
             lruList.splice(lruList.begin(), lruList, lruMap[iid]);
-            wasmCache[iid] = value;
+            store(iid, value);
         } else if (hasFlag == 0) { // directly insert
-            wasmCache[iid] = value;
+            store(iid, value);
             lruList.push_front(iid);
             lruMap[iid] = lruList.begin();
             deleteSome();
@@ -73,7 +75,7 @@ public:
     }
 
     void clear() override {
-        wasmCache.clear();
+        arena.clear();
         lruList.clear();
         lruMap.clear();
     }
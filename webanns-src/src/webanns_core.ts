@@ -32,10 +32,29 @@ export async function importData(file: File): Promise<void> {
     const lines = buffer.split("\n");
     buffer = lines.pop();
 
+    // lines without a fixed layer are inserted as one batch per chunk
+    const keys: string[] = [];
+    const vectors: number[][] = [];
+    const flush = async () => {
+      if (keys.length > 0) {
+        const dim = vectors[0].length;
+        await wragInstance.insertBatch(keys.splice(0), Float32Array.from(vectors.splice(0).flat()), dim);
+      }
+    };
     for (const line of lines) {
+      if (!line.trim()) {
+        continue;
+      }
       const jsonData = JSON.parse(line.trim());
-      await wragInstance.insert(jsonData.key, jsonData.vector, jsonData.layer);
+      if (jsonData.layer !== undefined) {
+        await flush();
+        await wragInstance.insert(jsonData.key, jsonData.vector, jsonData.layer);
+      } else {
+        keys.push(jsonData.key);
+        vectors.push(jsonData.vector);
+      }
     }
+    await flush();
   }
 }
 
@@ -43,43 +62,34 @@ export function exportJsonlIndex() {
   return wragInstance.exportJsonlIndex();
 }
 
-async function loadJsonlIndex(indexFile: File) {
-  console.log("Loading jsonl indexed...");
-
-  const stream = indexFile.stream();
-  const reader = stream.getReader();
-  let decoder = new TextDecoder();
-  let buffer = "";
-  let done = false;
+export async function exportJsonlIndexToStream(stream: WritableStream<Uint8Array>) {
+  await wragInstance.exportJsonlIndexToStream(stream);
+}
 
-  while (!done) {
-    const { value, done: readerDone } = await reader.read();
-    done = readerDone;
-    buffer += decoder.decode(value, { stream: !done });
+export function exportBinaryIndex(withVectors: boolean = false) {
+  return wragInstance.exportBinaryIndex(withVectors);
+}
 
-    const lines = buffer.split("\n");
-    buffer = lines.pop() || "";
+export async function loadBinaryIndex(indexFile: File): Promise<void> {
+  wragInstance.loadBinaryIndex(await indexFile.arrayBuffer());
+}
 
-    for (const line of lines) {
-      if (line.trim()) {
-        try {
-          wragInstance.loadJsonlIndex(line.trim());
-        } catch (error) {
-          console.error("Error parsing JSON line:", error, line);
-        }
-      }
-    }
-  }
+async function loadJsonlIndex(indexFile: File) {
+  console.log("Loading jsonl indexed...");
 
-  // Process any remaining buffered lines
-  if (buffer.trim()) {
-    try {
-      for (const line of buffer.split("\n")) {
-        wragInstance.loadJsonlIndex(line.trim());
+  // raw bytes go to wasm as they are, lines split across chunks are stitched there
+  const reader = indexFile.stream().getReader();
+  try {
+    while (true) {
+      const { value, done } = await reader.read();
+      if (done) {
+        break;
       }
-    } catch (error) {
-      console.error("Error parsing JSON line:", error, buffer);
+      wragInstance.loadJsonlIndexChunk(value, false);
     }
+    wragInstance.loadJsonlIndexChunk(new Uint8Array(0), true);
+  } catch (error) {
+    console.error("Error parsing JSONL index:", error);
   }
 }
 
@@ -140,6 +150,16 @@ async function loadJsonlData(file: File, indexFile: File) {
       console.error("Error parsing JSONL data:", error, buffer);
     }
   }
+
+  if (expSettings.pqSubspaces > 0) {
+    console.log("Building product quantizer...");
+    await wragInstance.buildProductQuantizer(expSettings.pqSubspaces);
+  }
+
+  if (expSettings.signPrefilter) {
+    console.log("Building sign codes...");
+    await wragInstance.buildSignCodes();
+  }
 }
 
 // Search function
@@ -188,3 +208,14 @@ export async function fastQuery(queryArray: number[], topK: number) {
   );
   return resultsArray;
 }
+
+// several sub-queries of one request in a single wasm call, results[i] belongs to queryArrays[i]
+export async function fastQueryBatch(queryArrays: number[][], topK: number) {
+  const resultsArray = await wragInstance.queryBatch(
+    Float32Array.from(queryArrays.flat()),
+    queryArrays.length,
+    topK,
+    expSettings.queryEf,
+  );
+  return resultsArray;
+}
@@ -3,6 +3,7 @@ import { DataManager } from "./dataManager";
 import { IndexedDBManager } from "./indexeddb";
 import { FastTimer, Timers } from "./utils";
 import { DEBUG } from "./macro";
+import { StoredVector, heapView, writeVector } from "./vectorEncoding";
 // import { MememoIndexJSON } from './mememo';
 
 export interface WRAGInterface {
@@ -14,11 +15,21 @@ export interface WRAGInterface {
   init(): void;
   exit(): void;
   insert(key: string, vector: Float32Array, layer?: number): void;
+  insertBatch(keys: string[], vectors: Float32Array, dim: number): Promise<void>;
   insertSkipIndex(key: string, vector: Float32Array, layer?: number): void;
   loadIndex(indexTree: string): void;
   loadJsonlIndex(indexLine: string): void;
+  loadJsonlIndexChunk(chunk: string | Uint8Array, last?: boolean): void;
+  freezeGraph(): void;
   exportJsonlIndex(): string;
+  exportJsonlIndexChunked(onChunk: (chunk: Uint8Array) => void, chunkSize?: number): void;
+  exportJsonlIndexToStream(stream: WritableStream<Uint8Array>, chunkSize?: number): Promise<void>;
+  exportBinaryIndex(withVectors?: boolean): Uint8Array;
+  loadBinaryIndex(index: ArrayBuffer | Uint8Array): void;
   query(query: number[], k: number, ef: number): void;
+  queryBatch(queries: Float32Array, nq: number, k: number, ef: number): Promise<string[][]>;
+  buildProductQuantizer(numSubspaces: number, trainSize?: number): Promise<void>;
+  buildSignCodes(trainSize?: number): Promise<void>;
   clearDB(): void; // async
   clearMonitor(): void;
   setMonitorMode(mode: string): void;
@@ -29,14 +40,14 @@ export interface WRAGInterface {
     idsPtr: number,
     valuesPtr: number,
     embSize: number,
-    flagPtr: number,
+    encoding: number,
   ): Promise<number>;
-  loadJ2W_nodb(iid: number, ptr: number, size: number): number;
+  loadJ2W_nodb(iid: number, ptr: number, size: number, encoding: number): number;
   loadJ2W(
     iid: number,
     ptr: number,
     size: number,
-    flagPtr: number,
+    encoding: number,
   ): Promise<number>;
   saveW2J(
     iidsPtr: number,
@@ -44,6 +55,7 @@ export interface WRAGInterface {
     valuesPtr: number,
     valuesSize: number,
     embedSize: number,
+    encoding: number,
   ): void;
 }
 
@@ -52,6 +64,7 @@ export class WRAG implements WRAGInterface {
   public hnswInstance: HNSW = null;
   public dbInstance: IndexedDBManager = new IndexedDBManager();
   public dataManager: DataManager = new DataManager();
+  public vectorEncoding: string = "float32";
   // private initFlag: boolean = false;
   // private lazyLoading: boolean = true;
   // private mememoKeyMap: Map<string, number> = new Map<string, number>();
@@ -84,6 +97,32 @@ export class WRAG implements WRAGInterface {
     if (settings.cacheStrategy !== undefined) {
       this.dataManager.valueManager.setCacheStrategy(settings.cacheStrategy);
     }
+    if (settings.vectorEncoding !== undefined) {
+      this.setVectorEncoding(settings.vectorEncoding);
+    }
+    if (settings.rerankFactor !== undefined) {
+      this.hnswInstance.setRerankFactor(settings.rerankFactor);
+    }
+    if (settings.pqRerankFactor !== undefined) {
+      this.hnswInstance.setPQRerankFactor(settings.pqRerankFactor);
+    }
+    if (settings.hammingMargin !== undefined) {
+      this.hnswInstance.setHammingMargin(settings.hammingMargin);
+    }
+    if (settings.buildThreads !== undefined) {
+      this.hnswInstance.setBuildThreads(settings.buildThreads);
+    }
+    if (settings.queryThreads !== undefined) {
+      this.hnswInstance.setQueryThreads(settings.queryThreads);
+    }
+  }
+
+  // "float32", "sq8", "fp16" or "bf16". sq8 keeps quantized rows in wasm and reranks query results
+  // from JS; fp16/bf16 are also how JS and IndexedDB store the vectors, so set it before inserting
+  setVectorEncoding(vectorEncoding: string) {
+    this.vectorEncoding = vectorEncoding;
+    this.hnswInstance.setVectorEncoding(vectorEncoding);
+    this.dataManager.valueManager.setVectorEncoding(vectorEncoding);
   }
 
   async clearDB(): Promise<void> {
@@ -107,23 +146,36 @@ export class WRAG implements WRAGInterface {
     // this.initFlag = true;
 
     let savedIndexTree = await this.dbInstance.getIndexTree();
-    if (savedIndexTree !== "") {
+    if (savedIndexTree.length > 0) {
       console.log("WRAG::init: Loading index tree from IndexedDB");
-      for (let line of savedIndexTree.split("\n")) {
-        this.loadJsonlIndex(line);
+      // stored vectors are only readable with the encoding they were written in
+      this.setVectorEncoding(await this.dbInstance.getVectorEncoding());
+      // older databases hold the tree as one string
+      const indexChunks = typeof savedIndexTree === "string" ? [savedIndexTree] : savedIndexTree;
+      for (const chunk of indexChunks) {
+        this.loadJsonlIndexChunk(chunk);
       }
+      this.loadJsonlIndexChunk("", true);
       // set value embed size at JS cache
       let valueKey = await this.dbInstance.getRandomKey();
       let value = await this.dbInstance.getValue(valueKey);
       this.dataManager.valueManager.set(valueKey, value);
       // set value embed size at Wasm
-      this.hnswInstance.insertSkipIndex(valueKey, value, -1);
+      this.hnswInstance.insertSkipIndex(
+        valueKey,
+        this.dataManager.valueManager.decode(value),
+        -1,
+      );
     }
   }
 
   async exit() {
-    let indexTree: string = this.hnswInstance.exportJsonlIndex();
-    await this.dbInstance.setIndexTree(indexTree);
+    // chunks end on line breaks, so each one decodes and reloads on its own
+    const decoder = new TextDecoder();
+    const indexChunks: string[] = [];
+    this.exportJsonlIndexChunked((chunk) => indexChunks.push(decoder.decode(chunk)));
+    await this.dbInstance.setIndexTree(indexChunks);
+    await this.dbInstance.setVectorEncoding(this.vectorEncoding);
   }
 
   async insert(key: string, vector: Float32Array, layer?: number) {
@@ -136,10 +188,10 @@ export class WRAG implements WRAGInterface {
     let curID = this.dataManager.allocateID();
     await this.dataManager.keyManager.set(curID, key, this.dbInstance); // set key cache in js
 
-    this.dataManager.valueManager.set(curID, vector); // set value cache in js
+    const storedVector = this.dataManager.valueManager.encode(vector);
+    this.dataManager.valueManager.set(curID, storedVector); // set value cache in js
     if (this.dataManager.valueManager.useDB) {
-      const curVector = Float32Array.from(vector);
-      await this.dbInstance.setValue(curID, curVector);
+      await this.dbInstance.setValue(curID, storedVector);
     }
 
     this.hnswInstance.insert(curID, vector, layer ?? -1); // insert into hnsw
@@ -153,6 +205,62 @@ export class WRAG implements WRAGInterface {
       );
   }
 
+  // vectors holds keys.length rows of dim floats back to back; keys and values go to IndexedDB in one
+  // bulk put each and the whole batch crosses into wasm with a single call and promise
+  async insertBatch(keys: string[], vectors: Float32Array, dim: number) {
+    if (vectors.length !== keys.length * dim) {
+      throw new Error("WRAG::insertBatch: vectors must hold keys.length * dim values");
+    }
+    this.timers.get("insert").start();
+
+    const resultPromise = new Promise((resolve, reject) => {
+      this.hnswInstance.setFinalPromise(resolve);
+    });
+
+    const ids = new Int32Array(keys.length);
+    const storedVectors: StoredVector[] = new Array(keys.length);
+    for (let i = 0; i < keys.length; i++) {
+      ids[i] = this.dataManager.allocateID();
+      storedVectors[i] = this.dataManager.valueManager.encode(
+        vectors.subarray(i * dim, (i + 1) * dim),
+      );
+      this.dataManager.valueManager.set(ids[i], storedVectors[i]); // set value cache in js
+    }
+    const idList = Array.from(ids);
+    await this.dbInstance.bulkSetKeys(idList, keys);
+    if (this.dataManager.valueManager.useDB) {
+      await this.dbInstance.bulkSetValues(idList, storedVectors);
+    }
+
+    this.hnswInstance.insertBatch(ids, vectors, dim); // insert into hnsw
+    let count = await resultPromise;
+
+    this.timers.get("insert").end();
+
+    if (DEBUG)
+      console.log(`WRAG::insertBatch: Inserted ${count} items into HNSW`);
+  }
+
+  async buildProductQuantizer(numSubspaces: number, trainSize: number = 10000) {
+    // trains on a sample and encodes every node, fetching vectors from the JS cache / IndexedDB;
+    // afterwards queries traverse on the codes and only fetch vectors to rerank
+    const resultPromise = new Promise((resolve, reject) => {
+      this.hnswInstance.setFinalPromise(resolve);
+    });
+    this.hnswInstance.buildProductQuantizer(numSubspaces, trainSize);
+    await resultPromise;
+  }
+
+  async buildSignCodes(trainSize: number = 10000) {
+    // one resident bit per dimension and node; afterwards queries skip neighbors whose code
+    // shows they cannot make the results, before fetching or scoring them
+    const resultPromise = new Promise((resolve, reject) => {
+      this.hnswInstance.setFinalPromise(resolve);
+    });
+    this.hnswInstance.buildSignCodes(trainSize);
+    await resultPromise;
+  }
+
   async query(queryEmb: number[], k: number, queryEf: number) {
     this.timers.get("performSearch").start();
 
@@ -192,6 +300,53 @@ export class WRAG implements WRAGInterface {
 
     this.timers.get("performSearch").end();
 
+    this.recheckCacheSize();
+
+    return resultsArray;
+  }
+
+  // queries holds nq rows of the embed size back to back; all of them run in one wasm call and
+  // their keys are looked up with one bulk read, results[q] are the keys found for query q
+  async queryBatch(
+    queries: Float32Array,
+    nq: number,
+    k: number,
+    queryEf: number,
+  ): Promise<string[][]> {
+    this.timers.get("performSearch").start();
+
+    let resultPromise: Promise<{ ids: Int32Array; distances: Float32Array }> =
+      new Promise((resolve, reject) => {
+        this.hnswInstance.setFinalPromise(resolve);
+      });
+    this.hnswInstance.queryBatch(queries, nq, k, queryEf);
+    const results = await resultPromise;
+    const resultIds = Array.from(results.ids); // views into wasm memory, copy before anything else runs
+
+    const found = resultIds.filter((iid) => iid !== -1);
+    const keys: string[] = await this.dataManager.keyManager.bulkGet(
+      found,
+      this.dbInstance,
+    );
+    const resultsArray: string[][] = [];
+    let next = 0;
+    for (let q = 0; q < nq; q++) {
+      const row: string[] = [];
+      for (let i = q * k; i < (q + 1) * k && resultIds[i] !== -1; i++) {
+        row.push(keys[next++]);
+      }
+      resultsArray.push(row);
+    }
+
+    this.timers.get("performSearch").end();
+
+    this.recheckCacheSize();
+
+    return resultsArray;
+  }
+
+  // falls back to the previous cache sizes once the optimized ones cause more DB reads than recorded
+  private recheckCacheSize() {
     if (this.optimizeCacheRecords.length > 0) {
       let cacheRecord: string = this.hnswInstance.getCacheCounter(); //return the counter in current mode!
       let cacheRecordArray = cacheRecord.split(",");
@@ -214,8 +369,6 @@ export class WRAG implements WRAGInterface {
         this.optimizeCacheRecords.pop();
       }
     }
-
-    return resultsArray;
   }
 
   // renameKey(oldKey: string) {
@@ -239,31 +392,49 @@ export class WRAG implements WRAGInterface {
     if (!indexLine.trim()) {
       return;
     }
-    let lineJson = JSON.parse(indexLine.trim());
-    if (lineJson.graphlayer !== undefined) {
-      this.hnswInstance.loadJsonlIndex(JSON.stringify(lineJson));
-    } else if (lineJson.key !== undefined) {
-      // New key entry in current graph layer
-      let keyId = this.key2id(String(lineJson.key));
-      this.hnswInstance.loadJsonlIndex(JSON.stringify({ key: keyId }));
-    } else if (lineJson.nkey !== undefined) {
-      // Neighbor key entry
-      const nKey = this.key2id(String(lineJson.nkey));
-      const distance = lineJson.distance;
-      this.hnswInstance.loadJsonlIndex(
-        JSON.stringify({ nkey: nKey, distance: distance }),
-      );
-    } else {
-      // meta data
-      lineJson.entryPointKey = this.key2id(lineJson.entryPointKey.toString());
-      this.hnswInstance.loadJsonlIndex(JSON.stringify(lineJson));
-    }
+    // keys in "<id>@@<suffix>" form are resolved on the wasm side, see key2id
+    this.hnswInstance.loadJsonlIndex(indexLine.trim());
+  }
+
+  loadJsonlIndexChunk(chunk: string | Uint8Array, last: boolean = false) {
+    // many lines per call, a line split across chunks is carried over to the next call
+    this.hnswInstance.loadJsonlIndexChunk(chunk, last);
+  }
+
+  freezeGraph() {
+    // pack the streamed adjacency into its compact CSR layout
+    this.hnswInstance.freezeGraph();
   }
 
   exportJsonlIndex(): string {
     return this.hnswInstance.exportJsonlIndex();
   }
 
+  exportJsonlIndexChunked(onChunk: (chunk: Uint8Array) => void, chunkSize: number = 1 << 16) {
+    // chunk is a view into wasm memory, it is reused as soon as onChunk returns
+    this.hnswInstance.exportJsonlIndexChunked(onChunk, chunkSize);
+  }
+
+  async exportJsonlIndexToStream(stream: WritableStream<Uint8Array>, chunkSize: number = 1 << 16) {
+    const writer = stream.getWriter();
+    const writes: Promise<void>[] = [];
+    this.exportJsonlIndexChunked((chunk) => {
+      writes.push(writer.write(chunk.slice()));
+    }, chunkSize);
+    await Promise.all(writes);
+    await writer.close();
+  }
+
+  exportBinaryIndex(withVectors: boolean = false): Uint8Array {
+    return this.hnswInstance.exportBinaryIndex(withVectors);
+  }
+
+  loadBinaryIndex(index: ArrayBuffer | Uint8Array) {
+    // replaces the current index, the graph is loaded already frozen
+    const bytes = index instanceof Uint8Array ? index : new Uint8Array(index);
+    this.hnswInstance.loadBinaryIndex(bytes);
+  }
+
   loadIndex(indexTree: string) {
     let parsedIndexTree = JSON.parse(indexTree);
 
@@ -320,10 +491,10 @@ export class WRAG implements WRAGInterface {
     let curID = this.dataManager.allocateID();
     await this.dataManager.keyManager.set(curID, key, this.dbInstance); // set key cache in js
 
-    this.dataManager.valueManager.set(curID, vector); // set value cache in js
+    const storedVector = this.dataManager.valueManager.encode(vector);
+    this.dataManager.valueManager.set(curID, storedVector); // set value cache in js
     if (this.dataManager.valueManager.useDB) {
-      const curVector = Float32Array.from(vector);
-      await this.dbInstance.setValue(curID, curVector);
+      await this.dbInstance.setValue(curID, storedVector);
     }
 
     this.hnswInstance.insertSkipIndex(curID, vector, layer ?? -1); // insert into hnsw
@@ -537,93 +708,92 @@ export class WRAG implements WRAGInterface {
     };
   }
 
+  // resolves 1 when every row was written, 0 otherwise; wasm awaits the promise itself
   async bulkGetFromDB(
     iids: number[],
     idsPtr: number,
     valuesPtr: number,
     embSize: number,
-    flagPtr: number,
+    encoding: number,
   ): Promise<number> {
     if (DEBUG)
       console.log(
         `WRAG::bulkGetFromDB: start to load iids=${iids}, idsPtr=${idsPtr}, valuesPtr=${valuesPtr}, embSize=${embSize}`,
       );
 
+    // rows are laid out back to back in the encoding wasm asked for
     const dataLength = iids.length;
-    for (let i = 0; i < dataLength; i++) {
-      this.wasmModule.HEAP32[idsPtr / 4 + i] = 0;
-    }
-    const totalSize = dataLength * embSize;
-    for (let i = 0; i < totalSize; i++) {
-      this.wasmModule.HEAPF32[valuesPtr / 4 + i] = 0;
-    }
-
-    return new Promise(async (resolve, reject) => {
-      try {
-        const iidResults = new Int32Array(
-          this.wasmModule.HEAP32.buffer,
-          idsPtr,
-          dataLength,
-        );
-        const valueResults = new Float32Array(
-          this.wasmModule.HEAPF32.buffer,
-          valuesPtr,
-          totalSize,
-        );
-
-        const loadResults = await this.dbInstance.bulkGetValues(iids);
+    const rowBytes =
+      embSize *
+      heapView(this.wasmModule.HEAPU8.buffer, valuesPtr, 0, encoding)
+        .BYTES_PER_ELEMENT;
+
+    try {
+      // rows the JS cache holds are served from it, only the rest go to IndexedDB
+      const found: { row: number; iid: number; value: StoredVector }[] = [];
+      const dbIids: number[] = [];
+      const dbRows: number[] = [];
+      for (let i = 0; i < dataLength; i++) {
+        const cached = this.dataManager.valueManager.get_nodb(iids[i]);
+        if (cached === undefined) {
+          dbIids.push(iids[i]);
+          dbRows.push(i);
+        } else {
+          found.push({ row: i, iid: iids[i], value: cached });
+        }
+      }
 
-        if (loadResults.length < dataLength) {
+      const loadResults =
+        dbIids.length > 0 ? await this.dbInstance.bulkGetValues(dbIids) : [];
+      for (let j = 0; j < dbIids.length; j++) {
+        const value = loadResults[j]?.value;
+        if (value === undefined || value.length === 0) {
           if (DEBUG)
-            console.log(`WRAG::bulkGetFromDB: Data for some iids not found.`);
-          this.wasmModule.HEAP32[flagPtr / 4] = 2; // some data not found
-          reject(0);
+            console.log(
+              `WRAG::bulkGetFromDB: Data for iid ${dbIids[j]} not found.`,
+            );
+          return 0;
         }
+        found.push({ row: dbRows[j], iid: dbIids[j], value });
+      }
 
-        for (let i = 0; i < dataLength; i++) {
-          const value = loadResults[i].value;
-
-          iidResults[i] = loadResults[i].iid;
-
-          if (value === undefined || value.length === 0) {
-            if (DEBUG)
-              console.log(
-                `WRAG::bulkGetFromDB: Data for iid ${iidResults[i]} not found.`,
-              );
-            this.wasmModule.HEAP32[flagPtr / 4] = 2; // some data not found
-            reject(0);
-          } else {
-            if (DEBUG)
-              console.log(
-                `WRAG::bulkGetFromDB: Data for iid ${iidResults[i]} found.`,
-              );
-
-            valueResults.set(value, i * embSize);
-          }
-        }
-        this.wasmModule.HEAP32[flagPtr / 4] = 1; // all data loaded
-        resolve(1);
-      } catch (error) {
-        if (DEBUG)
-          console.error(`WRAG::bulkGetFromDB: Error loading data: ${error}`);
-        this.wasmModule.HEAP32[flagPtr / 4] = 2; // some data not found
-        reject(0);
+      // write only after the await, views taken before it go stale if the heap grows meanwhile
+      const iidResults = new Int32Array(
+        this.wasmModule.HEAP32.buffer,
+        idsPtr,
+        dataLength,
+      );
+      for (const { row, iid, value } of found) {
+        iidResults[row] = iid;
+        writeVector(
+          this.wasmModule.HEAPU8.buffer,
+          valuesPtr + row * rowBytes,
+          value,
+          this.dataManager.valueManager.encoding,
+          encoding,
+        );
       }
-    });
+      return 1;
+    } catch (error) {
+      if (DEBUG)
+        console.error(`WRAG::bulkGetFromDB: Error loading data: ${error}`);
+      return 0;
+    }
   }
 
-  loadJ2W_nodb(iid: number, ptr: number, size: number): number {
+  loadJ2W_nodb(iid: number, ptr: number, size: number, encoding: number): number {
     // if iid in cache, load from cache
     // else return 0
-    let value: Float32Array | undefined =
+    let value: StoredVector | undefined =
       this.dataManager.valueManager.get_nodb(iid);
     if (value !== undefined) {
-      const floatArray = new Float32Array(
-        this.wasmModule.HEAPF32.buffer,
+      writeVector(
+        this.wasmModule.HEAPU8.buffer,
         ptr,
-        size,
+        value,
+        this.dataManager.valueManager.encoding,
+        encoding,
       );
-      floatArray.set(value);
       if (DEBUG) console.log(`WRAG::loadJ2W_nodb: Data for iid ${iid} loaded.`);
       return 1;
     } else {
@@ -638,38 +808,28 @@ export class WRAG implements WRAGInterface {
     iid: number,
     ptr: number,
     size: number,
-    flagPtr: number,
+    encoding: number,
   ): Promise<number> {
-    // load data from JavaScript to WebAssembly
+    // load data from JavaScript to WebAssembly, resolves 1 when loaded and 0 when not found
     if (DEBUG)
       console.log(
         `WRAG::loadJ2W: start to load iid=${iid}, ptr=${ptr}, size=${size}`,
       );
 
-    for (let i = 0; i < size; i++) {
-      this.wasmModule.HEAPF32[ptr / 4 + i] = 0;
+    const value = await this.dataManager.valueManager.get(iid, this.dbInstance);
+    if (value === undefined || value.length === 0) {
+      if (DEBUG) console.log(`WRAG::loadJ2W: Data for iid ${iid} not found.`);
+      return 0;
     }
-
-    return new Promise(async (resolve, reject) => {
-      this.dataManager.valueManager.get(iid, this.dbInstance).then((value) => {
-        if (value === undefined || value.length === 0) {
-          if (DEBUG)
-            console.log(`WRAG::loadJ2W: Data for iid ${iid} not found.`);
-          this.wasmModule.HEAP32[flagPtr / 4] = 2;
-          reject(0);
-        } else {
-          const floatArray = new Float32Array(
-            this.wasmModule.HEAPF32.buffer,
-            ptr,
-            size,
-          );
-          floatArray.set(value);
-          this.wasmModule.HEAP32[flagPtr / 4] = 1;
-          if (DEBUG) console.log(`WRAG::loadJ2W: Data for iid ${iid} loaded.`);
-          resolve(1);
-        }
-      });
-    });
+    writeVector(
+      this.wasmModule.HEAPU8.buffer,
+      ptr,
+      value,
+      this.dataManager.valueManager.encoding,
+      encoding,
+    );
+    if (DEBUG) console.log(`WRAG::loadJ2W: Data for iid ${iid} loaded.`);
+    return 1;
   }
 
   saveW2J(
@@ -678,17 +838,19 @@ export class WRAG implements WRAGInterface {
     valuesPtr: number,
     valuesSize: number,
     embedSize: number,
+    encoding: number,
   ) {
-    // save data from WebAssembly to JavaScript
+    // save data from WebAssembly to JavaScript, wasm already encoded the rows the way JS stores them
     const iids = new Int32Array(
       this.wasmModule.HEAP32.buffer,
       iidsPtr,
       iidsSize,
     );
-    const values = new Float32Array(
-      this.wasmModule.HEAPF32.buffer,
+    const values = heapView(
+      this.wasmModule.HEAPU8.buffer,
       valuesPtr,
       valuesSize,
+      encoding,
     );
     for (let i = 0, emb_i = 0; i < iids.length; i++, emb_i += embedSize) {
       const iid = iids[i];
@@ -0,0 +1,43 @@
+// An index exported while empty has entryPointKey -1; loading it must keep the index empty so the
+// first insert becomes the entry point instead of searching from a node that does not exist.
+#include <iostream>
+#include <string>
+#include <vector>
+#include "hnsw.hpp"
+
+static int failures = 0;
+
+static void check(bool condition, const std::string& what) {
+    if (!condition) {
+        std::cerr << "FAILED: " << what << std::endl;
+        ++failures;
+    }
+}
+
+static void insertAndQuery(HNSW& hnsw, const std::string& what) {
+    check(hnsw.ids.size() == 0, what + ": no ids after loading an empty index");
+    try {
+        hnsw.insert(7, std::vector<float>{ 1.0f, 2.0f, 3.0f });
+        hnsw.query(std::vector<float>{ 1.0f, 2.0f, 3.0f }, 1);
+        std::vector<Candidate> results = hnsw.getQueryResults();
+        check(results.size() == 1 && results[0].iid == 7, what + ": the inserted node is found");
+    } catch (const std::exception& e) {
+        check(false, what + ": " + e.what());
+    }
+}
+
+int main() {
+    HNSW empty;
+    std::string jsonl = empty.exportJsonlIndex();
+
+    HNSW fromJsonl;
+    fromJsonl.loadJsonlIndexChunk(jsonl.data(), jsonl.size(), true);
+    insertAndQuery(fromJsonl, "jsonl round trip");
+
+    HNSW fromJson;
+    fromJson.loadIndex(R"({"m":16,"efConstruction":100,"mMax0":32,"ml":0.36,"seed":0,)"
+                       R"("distanceFunctionType":"euclidean","entryPointKey":-1,"graphLayers":[]})");
+    insertAndQuery(fromJson, "json index");
+
+    return failures == 0 ? 0 : 1;
+}